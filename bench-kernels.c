@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include "rc4prga.h"
+#include "recovery.h"
+#include "bench.h"
+
+/* Microbenchmarks of the hot-path kernels, compiled once per word size
+ *
+ * The kernels are timed on candidates cut out of a real RC4 state (half
+ * of the entries known), so update_state() and step() take the same
+ * branches as in the middle of a search. Every call is undone through
+ * the trail, so all iterations see the same input.
+*/
+
+// Results go here so that the compiler cannot drop the calls
+static volatile long sink;
+
+/* Build a candidate from the true permutation <s>
+ *
+ * Every entry is known with probability 1/2, S[force1] and S[force2] are
+ * always known and S[hide] never is (pass -1 to skip any of them).
+*/
+static candidate partial_candidate(uint8_t *s, uint64_t *rnd, trail *tr, int force1, int force2, int hide)
+{
+  candidate c = root();
+  int x;
+  for(x=0;x<SIZE;x++)
+  {
+    if(x == hide)
+      continue;
+    if(x == force1 || x == force2 || (bench_rand(rnd) & 1))
+      assign(&c, tr, x, s[x]);
+  }
+  tr->top = 0; // this is the base of every iteration
+  return c;
+}
+
+/* Time rc4_step(), rc4_prga_lanes(), update_state(), step() and guess_entry()
+ *
+ * @param iters Number of calls of each kernel
+ * @param seed Seed of the RC4 key
+ * @param r Nanoseconds per call go here
+ * @return void
+*/
+void micro_bench(long iters, uint64_t seed, struct micro_result *r)
+{
+  uint8_t key[16];
+  uint8_t s[SIZE];
+  uint8_t prev[SIZE];
+  uint8_t z[1];
+  undo entries[4*SIZE];
+  trail tr = { entries, 0 };
+  uint64_t rnd = seed;
+  int i = 0, j = 0;
+  long n, acc = 0;
+  double t0;
+  int l;
+
+  for(l=0;l<sizeof(key);l++)
+    key[l] = bench_rand(&rnd);
+  rc4_init(key, sizeof(key), s);
+
+  // rc4_step(): also moves the state away from the KSA output
+  t0 = bench_now();
+  for(n=0;n<iters;n++)
+  {
+    i = ind(i+1);
+    acc += rc4_step(s, i, &j);
+  }
+  r->rc4_step = (bench_now()-t0)*1e9/iters;
+
+  // rc4_prga_lanes(): the same number of keystream bytes, spread over the lanes
+  {
+    struct rc4_lanes st;
+    uint8_t out[RC4_LANES*256];
+    uint8_t *keys[RC4_LANES];
+    int keylens[RC4_LANES];
+    for(l=0;l<RC4_LANES;l++)
+    {
+      keys[l] = key;
+      keylens[l] = sizeof(key)-l;
+    }
+    rc4_init_lanes(keys, keylens, &st);
+    t0 = bench_now();
+    for(n=0;n<iters;n+=RC4_LANES*256)
+    {
+      rc4_prga_lanes(&st, out, 256);
+      acc += out[(n/(RC4_LANES*256)) % sizeof(out)]; // a different byte every round
+    }
+    r->rc4_prga_lanes = (bench_now()-t0)*1e9/n;
+  }
+
+  // one more step, keeping the state before and after it
+  int prev_i = i, prev_j = j;
+  memcpy(prev, s, SIZE);
+  i = ind(i+1);
+  z[0] = rc4_step(s, i, &j);
+
+  // update_state(): S[i] and S[j] known, so Z[t] is placed and checked
+  int idx = ind(s[i]+s[j]);
+  candidate c = partial_candidate(s, &rnd, &tr, i, j, (idx == i || idx == j) ? -1 : idx);
+  c.i = i;
+  c.j = j;
+  c.t = 0;
+  t0 = bench_now();
+  for(n=0;n<iters;n++)
+  {
+    acc += update_state(&c, &tr, z);
+    rollback(&c, &tr, 0);
+  }
+  r->update_state = (bench_now()-t0)*1e9/iters;
+
+  // step(): S[i] unknown, so it is guessed (and S[j] too if it is unknown)
+  c = partial_candidate(prev, &rnd, &tr, -1, -1, ind(prev_i+1));
+  c.i = prev_i;
+  c.j = prev_j;
+  c.t = 0;
+  t0 = bench_now();
+  for(n=0;n<iters;n++)
+  {
+    acc += step(&c, &tr, 0, 0);
+    rollback(&c, &tr, 0);
+    c.i = prev_i;
+    c.j = prev_j;
+  }
+  r->step = (bench_now()-t0)*1e9/iters;
+
+  // guess_entry(): scan for unused values from every start position
+  t0 = bench_now();
+  for(n=0;n<iters;n++)
+    acc += guess_entry(&c, n & (SIZE-1));
+  r->guess_entry = (bench_now()-t0)*1e9/iters;
+
+  sink = acc;
+}
+
+const struct bench_kernels ALPHA_NAME(bench_kernels) = { ALPHA, micro_bench };
@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "util.h"
+#include "rc4prga.h"
+#include "recovery.h"
+#include "bench.h"
+
+/* Benchmark of the state recovery
+ *
+ * End-to-end: for every word size and keystream length in the grid,
+ * recover the state from the keystreams of <runs> random keys (fixed
+ * seed) and print one CSV line with time-to-solution percentiles, nodes
+ * visited, nodes/sec and peak RSS. Every run is a forked child, so that
+ * the RSS is its own and a run over the time limit can be killed.
+ *
+ * Micro: nanoseconds per call of the hot-path kernels, one CSV line per
+ * kernel and word size, and the throughput of the hex codec (SSE2 and the
+ * scalar reference) in MB of binary data per second.
+*/
+
+#define MAX_GRID (16)
+// Binary data converted per round of the hex codec benchmark
+#define HEX_BENCH_BYTES (1<<20)
+
+/* What a child reports about its run */
+struct run_struct
+{
+  int found;
+  long nodes;
+  double secs;
+  long rss_kb; // filled in by the parent
+  int timeout; // filled in by the parent
+};
+
+typedef struct run_struct run;
+
+/* Parse a comma separated list of integers into <out>
+ *
+ * @return Number of integers parsed
+*/
+int parse_list(char *str, int *out, int max)
+{
+  int n = 0;
+  char *tok = strtok(str, ",");
+  while(tok != NULL && n < max)
+  {
+    out[n++] = atoi(tok);
+    tok = strtok(NULL, ",");
+  }
+  return n;
+}
+
+/* Recover the state from <z> in a child process
+ *
+ * @param k Recovery kernels
+ * @param z Keystream
+ * @param z_len Length of the keystream
+ * @param nworkers Number of threads of the solver
+ * @param timeout The child is killed after this many seconds
+ * @param r Result of the run
+ * @return void
+*/
+void run_child(const struct recovery_kernels *k, uint8_t *z, int z_len, int nworkers, int timeout, run *r)
+{
+  int fd[2];
+  struct rusage ru;
+  int status;
+
+  memset(r, 0, sizeof(*r));
+  if(pipe(fd) != 0)
+  {
+    perror("pipe");
+    exit(-1);
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid < 0)
+  {
+    perror("fork");
+    exit(-1);
+  }
+  if(pid == 0)
+  {
+    struct recovery_params p;
+    struct recovery_result res;
+    run out;
+
+    close(fd[0]);
+    alarm(timeout);
+    memset(&p, 0, sizeof(p));
+    p.z = z;
+    p.z_len = z_len;
+    p.nworkers = nworkers;
+    p.split_depth = DEFAULT_SPLIT_DEPTH;
+    memset(&out, 0, sizeof(out));
+    double t0 = bench_now();
+    out.found = k->solve(&p, &res);
+    out.secs = bench_now() - t0;
+    out.nodes = res.nodes;
+    if(write(fd[1], &out, sizeof(out)) != sizeof(out))
+      _exit(1);
+    _exit(0);
+  }
+
+  close(fd[1]);
+  if(read(fd[0], r, sizeof(*r)) != sizeof(*r))
+    r->timeout = 1;
+  close(fd[0]);
+  wait4(pid, &status, 0, &ru);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    r->timeout = 1;
+  if(r->timeout)
+    r->secs = timeout;
+  r->rss_kb = ru.ru_maxrss;
+}
+
+int cmp_secs(const void *a, const void *b)
+{
+  const run *x = (const run *)a;
+  const run *y = (const run *)b;
+  if(x->timeout != y->timeout)
+    return x->timeout - y->timeout;
+  return (x->secs > y->secs) - (x->secs < y->secs);
+}
+
+/* Print the <q>-th percentile of the (sorted) runs in milliseconds,
+ * "timeout" if it falls on a run that was killed
+*/
+void print_percentile(run *runs, int n, double q)
+{
+  int l = (int)(q*(n-1) + 0.5);
+  if(runs[l].timeout)
+    printf(",timeout");
+  else
+    printf(",%.3f", runs[l].secs*1e3);
+}
+
+/* End-to-end benchmark of one grid point */
+void bench_point(int alpha, int z_len, int runs, uint64_t seed, int nworkers, int timeout)
+{
+  const struct rc4_kernels *rk = rc4_select(alpha);
+  const struct recovery_kernels *k = recovery_select(alpha);
+  int size = 1<<alpha;
+  uint8_t s[MAX_SIZE];
+  uint8_t key[16];
+  uint8_t *z = (uint8_t *)malloc(z_len);
+  run *r = (run *)malloc(runs*sizeof(run));
+  // every grid point gets its own keys, independent of the rest of the grid
+  uint64_t rnd = seed ^ ((uint64_t)alpha << 32) ^ (uint64_t)z_len;
+  int timeouts = 0;
+  long nodes = 0, rss = 0;
+  double secs = 0;
+  int l, n;
+
+  for(n=0;n<runs;n++)
+  {
+    int i, j = 0;
+    for(l=0;l<sizeof(key);l++)
+      key[l] = bench_rand(&rnd);
+    rk->ksa(key, sizeof(key), s);
+    for(i=1;i<=z_len;i++)
+      z[i-1] = rk->prga(s, i&(size-1), &j);
+    run_child(k, z, z_len, nworkers, timeout, &r[n]);
+    if(r[n].timeout)
+      timeouts++;
+    else
+    {
+      nodes += r[n].nodes;
+      secs += r[n].secs;
+    }
+    if(r[n].rss_kb > rss)
+      rss = r[n].rss_kb;
+  }
+
+  qsort(r, runs, sizeof(run), cmp_secs);
+  printf("%d,%d,%d,%d", alpha, z_len, runs, timeouts);
+  print_percentile(r, runs, 0.5);
+  print_percentile(r, runs, 0.9);
+  print_percentile(r, runs, 0.99);
+  print_percentile(r, runs, 1.0);
+  if(runs > timeouts)
+    printf(",%ld,%.0f", nodes/(runs-timeouts), secs > 0 ? nodes/secs : 0);
+  else
+    printf(",,");
+  printf(",%ld\n", rss);
+  fflush(stdout);
+  free(z);
+  free(r);
+}
+
+/* Print the MB/s of <rounds> calls of <convert> on <bytes> of binary data */
+void print_rate(const char *name, double secs, long rounds, size_t bytes)
+{
+  printf("%s,%zu,%.1f\n", name, bytes, secs > 0 ? rounds*(double)bytes/secs*1e-6 : 0);
+}
+
+/* Throughput of the hex codec: toHex()/fromHex() against their scalar
+ * references, and fromHexChunk() on lines of 64 digits
+*/
+void bench_hex(uint64_t seed, long rounds)
+{
+  uint8_t *bin = (uint8_t *)malloc(HEX_BENCH_BYTES);
+  uint8_t *hex = (uint8_t *)malloc(2*HEX_BENCH_BYTES+1);
+  uint8_t *lines = (uint8_t *)malloc(2*HEX_BENCH_BYTES + HEX_BENCH_BYTES/32);
+  uint8_t *out = (uint8_t *)malloc(HEX_BENCH_BYTES);
+  size_t nlines = 0, l;
+  long r;
+  double t;
+
+  for(l=0;l<HEX_BENCH_BYTES;l++)
+    bin[l] = bench_rand(&seed);
+  toHexScalar(hex, bin, HEX_BENCH_BYTES, 0);
+  for(l=0;l<2*HEX_BENCH_BYTES;l+=64)
+  {
+    memcpy(lines+nlines, hex+l, 64);
+    nlines += 64;
+    lines[nlines++] = '\n';
+  }
+
+  printf("codec,bytes,mb_per_sec\n");
+  t = bench_now();
+  for(r=0;r<rounds;r++)
+    toHexScalar(hex, bin, HEX_BENCH_BYTES, 0);
+  print_rate("toHexScalar", bench_now() - t, rounds, HEX_BENCH_BYTES);
+  t = bench_now();
+  for(r=0;r<rounds;r++)
+    toHex(hex, bin, HEX_BENCH_BYTES, 0);
+  print_rate("toHex", bench_now() - t, rounds, HEX_BENCH_BYTES);
+  t = bench_now();
+  for(r=0;r<rounds;r++)
+    if(fromHexScalar(out, hex, HEX_BENCH_BYTES, 0) < 0)
+      break;
+  print_rate("fromHexScalar", bench_now() - t, rounds, HEX_BENCH_BYTES);
+  t = bench_now();
+  for(r=0;r<rounds;r++)
+    if(fromHex(out, hex, HEX_BENCH_BYTES, 0) < 0)
+      break;
+  print_rate("fromHex", bench_now() - t, rounds, HEX_BENCH_BYTES);
+  t = bench_now();
+  for(r=0;r<rounds;r++)
+  {
+    struct hex_stream hs;
+    size_t o = 0;
+    hexStreamInit(&hs);
+    for(l=0;l<nlines;l+=2*HEX_CHUNK) // the pieces state-recovery --input converts
+      o += fromHexChunk(&hs, out+o, lines+l, nlines-l < 2*HEX_CHUNK ? nlines-l : 2*HEX_CHUNK);
+  }
+  print_rate("fromHexChunk", bench_now() - t, rounds, HEX_BENCH_BYTES);
+  if(memcmp(out, bin, HEX_BENCH_BYTES) != 0)
+    fprintf(stderr, "hex codec: wrong result\n");
+  fflush(stdout);
+  free(bin);
+  free(hex);
+  free(lines);
+  free(out);
+}
+
+void usage()
+{
+  printf("Benchmark RC4 state recovery, results are printed as CSV\n\n");
+  printf("Usage: recovery-bench [-e|-m] [-a ALPHAS] [-L LENGTHS] [-n RUNS] [-S SEED] [-T SECONDS] [-j THREADS] [-i ITERS]\n");
+  printf("          -e		end-to-end benchmark only\n");
+  printf("          -m		microbenchmarks only\n");
+  printf("          -a ALPHAS	comma separated word sizes (default 3,4)\n");
+  printf("          -L LENGTHS	comma separated keystream lengths (default 24,32,48,64)\n");
+  printf("          -n RUNS	random keys per grid point (default 20)\n");
+  printf("          -S SEED	seed of the random keys (default 1)\n");
+  printf("          -T SECONDS	time limit of one run (default 10)\n");
+  printf("          -j THREADS	threads of the solver (default 1)\n");
+  printf("          -i ITERS	calls per kernel in the microbenchmarks (default 10000000),\n");
+  printf("          		the hex codec converts ITERS/1000000 MB\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  char alphas_default[] = "3,4";
+  char lengths_default[] = "24,32,48,64";
+  char *alphas_str = alphas_default;
+  char *lengths_str = lengths_default;
+  int alphas[MAX_GRID], lengths[MAX_GRID];
+  int runs = 20, nworkers = 1, timeout = 10;
+  long iters = 10000000;
+  uint64_t seed = 1;
+  int e2e = 1, micro = 1;
+  int opt, a, l;
+
+  while((opt = getopt(argc, argv, "ema:L:n:S:T:j:i:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'e': micro = 0; break;
+      case 'm': e2e = 0; break;
+      case 'a': alphas_str = optarg; break;
+      case 'L': lengths_str = optarg; break;
+      case 'n': runs = atoi(optarg); break;
+      case 'S': seed = strtoull(optarg, NULL, 0); break;
+      case 'T': timeout = atoi(optarg); break;
+      case 'j': nworkers = atoi(optarg); break;
+      case 'i': iters = atol(optarg); break;
+      default: usage();
+    }
+  }
+  int nalphas = parse_list(alphas_str, alphas, MAX_GRID);
+  int nlengths = parse_list(lengths_str, lengths, MAX_GRID);
+  if(optind != argc || runs < 1 || nworkers < 1 || timeout < 1 || iters < 1)
+    usage();
+  for(a=0;a<nalphas;a++)
+    if(recovery_select(alphas[a]) == NULL)
+      usage();
+  for(l=0;l<nlengths;l++)
+    if(lengths[l] < 1)
+      usage();
+
+  if(e2e)
+  {
+    printf("alpha,z_len,runs,timeouts,p50_ms,p90_ms,p99_ms,max_ms,mean_nodes,nodes_per_sec,peak_rss_kb\n");
+    for(a=0;a<nalphas;a++)
+      for(l=0;l<nlengths;l++)
+        bench_point(alphas[a], lengths[l], runs, seed, nworkers, timeout);
+  }
+
+  if(micro)
+  {
+    if(e2e)
+      printf("\n");
+    printf("kernel,alpha,iters,ns_per_call\n");
+    for(a=0;a<nalphas;a++)
+    {
+      struct micro_result r;
+      bench_select(alphas[a])->micro(iters, seed, &r);
+      printf("rc4_step,%d,%ld,%.2f\n", alphas[a], iters, r.rc4_step);
+      printf("rc4_prga_lanes,%d,%ld,%.2f\n", alphas[a], iters, r.rc4_prga_lanes);
+      printf("update_state,%d,%ld,%.2f\n", alphas[a], iters, r.update_state);
+      printf("step,%d,%ld,%.2f\n", alphas[a], iters, r.step);
+      printf("guess_entry,%d,%ld,%.2f\n", alphas[a], iters, r.guess_entry);
+      fflush(stdout);
+    }
+    printf("\n");
+    bench_hex(seed, iters/1000000 > 0 ? iters/1000000 : 1);
+  }
+  return 0;
+}
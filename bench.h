@@ -0,0 +1,72 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <time.h>
+#include "rc4prga.h"
+
+/* Nanoseconds per call of the hot-path kernels of one word size */
+struct micro_result
+{
+  double rc4_step;
+  double rc4_prga_lanes; // per keystream byte of one lane
+  double update_state;
+  double step;
+  double guess_entry;
+};
+
+struct bench_kernels
+{
+  int alpha;
+  void (*micro)(long iters, uint64_t seed, struct micro_result *r); // micro_bench()
+};
+
+extern const struct bench_kernels bench_kernels_a3;
+extern const struct bench_kernels bench_kernels_a4;
+extern const struct bench_kernels bench_kernels_a5;
+extern const struct bench_kernels bench_kernels_a6;
+extern const struct bench_kernels bench_kernels_a7;
+extern const struct bench_kernels bench_kernels_a8;
+
+/* Get microbenchmarks for word size <alpha>, NULL if it is not supported
+*/
+static inline const struct bench_kernels *bench_select(int alpha)
+{
+  switch(alpha)
+  {
+    case 3: return &bench_kernels_a3;
+    case 4: return &bench_kernels_a4;
+    case 5: return &bench_kernels_a5;
+    case 6: return &bench_kernels_a6;
+    case 7: return &bench_kernels_a7;
+    case 8: return &bench_kernels_a8;
+  }
+  return NULL;
+}
+
+/* Deterministic pseudo random numbers (splitmix64), so that every run
+ * of the benchmark sees the same keys
+*/
+static inline uint64_t bench_rand(uint64_t *state)
+{
+  uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/* Seconds on the monotonic clock */
+static inline double bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+#ifdef ALPHA
+#define micro_bench ALPHA_NAME(micro_bench)
+
+void micro_bench(long iters, uint64_t seed, struct micro_result *r);
+#endif // ALPHA
+
+#endif // __BENCH_H__
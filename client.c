@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+/* Client of recovery-daemon
+ *
+ * Sends its keystreams as one "solve" request each (or a "stats" request)
+ * and prints the answers as they arrive, one JSON line each.
+*/
+
+/* Write all of <buf> to <fd>
+ *
+ * @return 0, -1 on error
+*/
+int write_all(int fd, const char *buf, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+void usage()
+{
+  printf("Send keystreams to recovery-daemon and print the answers as JSON lines\n\n");
+  printf("Usage: recovery-client [--socket PATH] [--alpha N] [--priority P] [--deadline MS] KEYSTREAMHEX...\n");
+  printf("       recovery-client [--socket PATH] --stats\n");
+  printf("          --socket PATH	socket of the daemon (default %s)\n", DEFAULT_SOCKET);
+  printf("          --alpha N	word size of the keystreams (default: the daemon's)\n");
+  printf("          --priority P	jobs with a higher priority run first (default 0)\n");
+  printf("          --deadline MS	give up on a job MS milliseconds after it arrived (default: never)\n");
+  printf("          --stats	print the queue, throughput and latency of the daemon\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option long_options[] =
+  {
+    {"socket", required_argument, 0, 'S'},
+    {"alpha", required_argument, 0, 'A'},
+    {"priority", required_argument, 0, 'P'},
+    {"deadline", required_argument, 0, 'D'},
+    {"stats", no_argument, 0, 's'},
+    {0, 0, 0, 0}
+  };
+  const char *path = DEFAULT_SOCKET;
+  char *options = NULL; // appended to every request
+  size_t options_len = 0;
+  FILE *opts = open_memstream(&options, &options_len);
+  int stats = 0;
+  int opt, l;
+
+  while((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 'S': path = optarg; break;
+      case 'A': fprintf(opts, " alpha=%d", atoi(optarg)); break;
+      case 'P': fprintf(opts, " priority=%d", atoi(optarg)); break;
+      case 'D': fprintf(opts, " deadline=%s", optarg); break;
+      case 's': stats = 1; break;
+      default: usage();
+    }
+  }
+  fclose(opts);
+  if(stats == (optind < argc))
+    usage();
+
+  int fd = daemon_connect(path);
+  if(fd < 0)
+  {
+    fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  FILE *in = fdopen(fd, "r");
+  int expected = stats ? 1 : argc - optind;
+  for(l=0;l<expected;l++)
+  {
+    size_t size = (stats ? 0 : strlen(argv[optind+l])) + options_len + 32;
+    char *req = (char *)malloc(size);
+    int n = stats ? snprintf(req, size, "stats\n") : snprintf(req, size, "solve %s id=%d%s\n", argv[optind+l], l, options);
+    if(write_all(fd, req, n) < 0)
+    {
+      fprintf(stderr, "Cannot send to %s\n", path);
+      return 1;
+    }
+    free(req);
+  }
+  shutdown(fd, SHUT_WR); // no more requests
+
+  char *line = NULL;
+  size_t cap = 0;
+  int got = 0;
+  while(got < expected && getline(&line, &cap, in) >= 0)
+  {
+    printf("%s", line);
+    fflush(stdout);
+    got++;
+  }
+  free(line);
+  free(options);
+  fclose(in);
+  if(got < expected)
+  {
+    fprintf(stderr, "The daemon hung up after %d of %d answers\n", got, expected);
+    return 1;
+  }
+  return 0;
+}
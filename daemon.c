@@ -0,0 +1,726 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "util.h" // convert from hex to binary
+#include "rc4prga.h"
+#include "recovery.h"
+#include "daemon.h"
+
+#ifndef DEFAULT_ALPHA
+  #define DEFAULT_ALPHA (4)
+#endif
+
+/* Recovery daemon
+ *
+ * A process that stays up and solves the keystreams its clients send over
+ * a Unix socket (see daemon.h for the protocol), so that a small job costs
+ * a line of text instead of starting state-recovery. Every connection has
+ * a reader thread which parses the requests and queues the jobs; a pool
+ * of worker threads takes them off the queue by priority and runs the
+ * sequential search on each. A watchdog thread stops the jobs whose
+ * deadline passed: running ones through recovery_params.cancel, queued
+ * ones by answering them straight away.
+*/
+
+// Jobs waiting for a worker before new ones are refused
+#define DEFAULT_QUEUE (1024)
+// Completed jobs the latency percentiles and the recent throughput are taken over
+#define LATENCY_WINDOW (4096)
+
+/* A client connection, shared by its reader and its unanswered jobs */
+struct conn_struct
+{
+  int fd;
+  pthread_mutex_t lock; // protects writes to <fd> and <refs>
+  int refs; // the reader and the jobs not answered yet
+};
+
+typedef struct conn_struct conn;
+
+/* A queued keystream */
+struct job_struct
+{
+  conn *c; // where the answer goes
+  long id;
+  int priority;
+  long seq; // arrival order, breaks ties between priorities
+  int alpha;
+  uint8_t *z;
+  int z_len;
+  double arrived;
+  double deadline; // 0 for none
+};
+
+typedef struct job_struct job;
+
+struct worker_struct
+{
+  pthread_t thread;
+  struct daemon_struct *d;
+  volatile sig_atomic_t cancel; // recovery_params.cancel of the running job
+  double deadline; // of the running job, 0 if none (under d->lock)
+};
+
+typedef struct worker_struct worker;
+
+struct daemon_struct
+{
+  pthread_mutex_t lock; // protects everything below
+  pthread_cond_t work; // a job was queued
+  pthread_cond_t watch; // a deadline was added
+  job **heap; // the queue: binary heap, see job_before()
+  job **expired; // room for max_queue jobs, used by watchdog_main()
+  int queued;
+  int max_queue;
+  long seq;
+  int running;
+  worker *workers;
+  int nworkers;
+  int lookahead; // -l of every job
+  int alpha; // of the jobs without alpha=
+  double started;
+  long accepted; // counters since the start
+  long rejected;
+  long done;
+  long solved;
+  long timeouts;
+  long errors; // jobs and requests answered with an error
+  double latency[LATENCY_WINDOW]; // of the last jobs, from arrival to answer
+  double finished[LATENCY_WINDOW]; // when they were answered
+  long nlatency;
+};
+
+typedef struct daemon_struct daemon_t;
+
+// Set by SIGINT/SIGTERM, the daemon stops accepting connections and exits
+static volatile sig_atomic_t stop_requested = 0;
+
+void on_stop(int sig)
+{
+  stop_requested = 1;
+}
+
+/* Seconds on the monotonic clock */
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Take a reference to a connection */
+void conn_retain(conn *c)
+{
+  pthread_mutex_lock(&c->lock);
+  c->refs++;
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* Drop a reference, the last one closes the connection */
+void conn_release(conn *c)
+{
+  pthread_mutex_lock(&c->lock);
+  int refs = --c->refs;
+  pthread_mutex_unlock(&c->lock);
+  if(refs > 0)
+    return;
+  close(c->fd);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
+
+/* Send one answer line; a client that went away is ignored
+ *
+ * @param c Connection
+ * @param buf The line, with its newline
+ * @param len Its length
+*/
+void conn_send(conn *c, const char *buf, size_t len)
+{
+  pthread_mutex_lock(&c->lock);
+  while(len > 0)
+  {
+    ssize_t n = send(c->fd, buf, len, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      break;
+    buf += n;
+    len -= n;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* Answer a request with {"id":N,"error":"..."} */
+void send_error(conn *c, long id, const char *error)
+{
+  char buf[256];
+  int n = snprintf(buf, sizeof(buf), "{\"id\":%ld,\"error\":\"%s\"}\n", id, error);
+  conn_send(c, buf, n);
+}
+
+/* Queue order: higher priority first, then first come first served */
+static inline int job_before(job *a, job *b)
+{
+  if(a->priority != b->priority)
+    return a->priority > b->priority;
+  return a->seq < b->seq;
+}
+
+/* Restore the heap below position <l> (under d->lock) */
+void heap_down(daemon_t *d, int l)
+{
+  while(1)
+  {
+    int best = l, c;
+    for(c=2*l+1;c<=2*l+2 && c<d->queued;c++)
+      if(job_before(d->heap[c], d->heap[best]))
+        best = c;
+    if(best == l)
+      return;
+    job *tmp = d->heap[l];
+    d->heap[l] = d->heap[best];
+    d->heap[best] = tmp;
+    l = best;
+  }
+}
+
+/* Queue a job (under d->lock, there must be room) */
+void heap_push(daemon_t *d, job *jb)
+{
+  int l = d->queued++;
+  d->heap[l] = jb;
+  while(l > 0 && job_before(d->heap[l], d->heap[(l-1)/2]))
+  {
+    job *tmp = d->heap[l];
+    d->heap[l] = d->heap[(l-1)/2];
+    d->heap[(l-1)/2] = tmp;
+    l = (l-1)/2;
+  }
+}
+
+/* Take the first job off the queue (under d->lock, it must not be empty) */
+job *heap_pop(daemon_t *d)
+{
+  job *jb = d->heap[0];
+  d->heap[0] = d->heap[--d->queued];
+  heap_down(d, 0);
+  return jb;
+}
+
+/* Account for an answered job (under d->lock) */
+void record_job(daemon_t *d, job *jb, double end, int found, int timeout, int error)
+{
+  d->done++;
+  d->solved += found > 0;
+  d->timeouts += timeout;
+  d->errors += error;
+  d->latency[d->nlatency % LATENCY_WINDOW] = end - jb->arrived;
+  d->finished[d->nlatency % LATENCY_WINDOW] = end;
+  d->nlatency++;
+}
+
+/* Answer a job and free it
+ *
+ * @param d Daemon
+ * @param jb The job
+ * @param started When a worker took it (the arrival if it never ran)
+ * @param found Return value of the search
+ * @param res Result of the search, NULL if it did not run
+*/
+void finish_job(daemon_t *d, job *jb, double started, long found, struct recovery_result *res)
+{
+  char buf[4096]; // holds a state of MAX_SIZE entries
+  int timeout = res == NULL || res->status == RECOVERY_CANCELLED;
+  int error = res != NULL && found < 0;
+  double end = now();
+  int n, l;
+
+  if(error)
+    n = snprintf(buf, sizeof(buf), "{\"id\":%ld,\"error\":\"%s\"}\n", jb->id, res->error);
+  else
+  {
+    n = snprintf(buf, sizeof(buf), "{\"id\":%ld,\"found\":%d,", jb->id, found > 0);
+    if(timeout)
+      n += snprintf(buf+n, sizeof(buf)-n, "\"timeout\":1,");
+    n += snprintf(buf+n, sizeof(buf)-n, "\"queue_ms\":%.3f,\"ms\":%.3f,\"nodes\":%ld",
+                  (started - jb->arrived)*1e3, (end - jb->arrived)*1e3, res != NULL ? res->nodes : 0);
+    if(found > 0)
+    {
+      n += snprintf(buf+n, sizeof(buf)-n, ",\"t\":%d,\"i\":%d,\"j\":%d,\"s\":[", res->t, res->i, res->j);
+      for(l=0;l<res->size;l++)
+        n += snprintf(buf+n, sizeof(buf)-n, l ? ",%d" : "%d", res->s[l]);
+      n += snprintf(buf+n, sizeof(buf)-n, "]");
+    }
+    n += snprintf(buf+n, sizeof(buf)-n, "}\n");
+  }
+  pthread_mutex_lock(&d->lock);
+  record_job(d, jb, end, found, timeout, error);
+  pthread_mutex_unlock(&d->lock);
+  conn_send(jb->c, buf, n);
+  conn_release(jb->c);
+  free(jb->z);
+  free(jb);
+}
+
+/* Worker thread: run queued jobs for good */
+void *worker_main(void *arg)
+{
+  worker *w = (worker *)arg;
+  daemon_t *d = w->d;
+
+  while(1)
+  {
+    pthread_mutex_lock(&d->lock);
+    while(d->queued == 0)
+      pthread_cond_wait(&d->work, &d->lock);
+    job *jb = heap_pop(d);
+    double started = now();
+    if(jb->deadline > 0 && started >= jb->deadline)
+    {
+      pthread_mutex_unlock(&d->lock);
+      finish_job(d, jb, jb->arrived, 0, NULL);
+      continue;
+    }
+    d->running++;
+    w->cancel = 0;
+    w->deadline = jb->deadline;
+    if(jb->deadline > 0)
+      pthread_cond_signal(&d->watch);
+    pthread_mutex_unlock(&d->lock);
+
+    struct recovery_params p;
+    struct recovery_result res;
+    memset(&p, 0, sizeof(p));
+    p.z = jb->z;
+    p.z_len = jb->z_len;
+    p.nworkers = 1;
+    p.split_depth = DEFAULT_SPLIT_DEPTH;
+    p.lookahead = d->lookahead;
+    p.nshards = 1;
+    p.cancel = &w->cancel;
+    long found = recovery_select(jb->alpha)->solve(&p, &res);
+
+    pthread_mutex_lock(&d->lock);
+    w->deadline = 0;
+    d->running--;
+    pthread_mutex_unlock(&d->lock);
+    finish_job(d, jb, started, found, &res);
+  }
+  return NULL;
+}
+
+/* Watchdog thread: stop the running jobs whose deadline passed and answer
+ * the queued ones
+*/
+void *watchdog_main(void *arg)
+{
+  daemon_t *d = (daemon_t *)arg;
+  job **expired = d->expired;
+  int l;
+
+  pthread_mutex_lock(&d->lock);
+  while(1)
+  {
+    double t = now(), next = 0;
+    for(l=0;l<d->nworkers;l++)
+    {
+      worker *w = &d->workers[l];
+      if(w->deadline > 0 && w->deadline <= t)
+      {
+        w->cancel = 1;
+        w->deadline = 0;
+      }
+      else if(w->deadline > 0 && (next == 0 || w->deadline < next))
+        next = w->deadline;
+    }
+    int nexpired = 0, kept = 0;
+    for(l=0;l<d->queued;l++)
+    {
+      job *jb = d->heap[l];
+      if(jb->deadline > 0 && jb->deadline <= t)
+        expired[nexpired++] = jb;
+      else
+      {
+        d->heap[kept++] = jb;
+        if(jb->deadline > 0 && (next == 0 || jb->deadline < next))
+          next = jb->deadline;
+      }
+    }
+    if(nexpired > 0)
+    {
+      d->queued = kept;
+      for(l=kept/2-1;l>=0;l--)
+        heap_down(d, l);
+      pthread_mutex_unlock(&d->lock);
+      for(l=0;l<nexpired;l++)
+        finish_job(d, expired[l], expired[l]->arrived, 0, NULL);
+      pthread_mutex_lock(&d->lock);
+      continue;
+    }
+    if(next == 0)
+      pthread_cond_wait(&d->watch, &d->lock);
+    else
+    {
+      struct timespec ts;
+      ts.tv_sec = (time_t)next;
+      ts.tv_nsec = (long)((next - ts.tv_sec)*1e9);
+      pthread_cond_timedwait(&d->watch, &d->lock, &ts);
+    }
+  }
+  return NULL;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Answer a "stats" request
+ *
+ * Queue depth and counters since the start, the throughput since the start
+ * and over the last LATENCY_WINDOW jobs, and the percentiles of their
+ * latency (arrival to answer, in milliseconds).
+*/
+void send_stats(daemon_t *d, conn *c)
+{
+  static const double q[] = { 0.5, 0.9, 0.99, 1.0 };
+  static const char *names[] = { "p50", "p90", "p99", "max" };
+  double lat[LATENCY_WINDOW];
+  char buf[1024];
+  int l, n;
+
+  pthread_mutex_lock(&d->lock);
+  double t = now();
+  int nlat = d->nlatency < LATENCY_WINDOW ? d->nlatency : LATENCY_WINDOW;
+  memcpy(lat, d->latency, nlat*sizeof(double));
+  double oldest = nlat > 0 ? d->finished[(d->nlatency - nlat) % LATENCY_WINDOW] : t;
+  double uptime = t - d->started;
+  n = snprintf(buf, sizeof(buf), "{\"queued\":%d,\"running\":%d,\"workers\":%d,\"accepted\":%ld,\"rejected\":%ld,"
+               "\"done\":%ld,\"solved\":%ld,\"timeouts\":%ld,\"errors\":%ld,\"uptime_s\":%.3f,\"jobs_per_sec\":%.1f,"
+               "\"recent_jobs_per_sec\":%.1f",
+               d->queued, d->running, d->nworkers, d->accepted, d->rejected, d->done, d->solved, d->timeouts,
+               d->errors, uptime, uptime > 0 ? d->done/uptime : 0, t > oldest ? nlat/(t - oldest) : 0);
+  pthread_mutex_unlock(&d->lock);
+
+  qsort(lat, nlat, sizeof(double), cmp_double);
+  n += snprintf(buf+n, sizeof(buf)-n, ",\"latency_ms\":{\"jobs\":%d", nlat);
+  for(l=0;l<4 && nlat>0;l++)
+    n += snprintf(buf+n, sizeof(buf)-n, ",\"%s\":%.3f", names[l], lat[(int)(q[l]*(nlat-1) + 0.5)]*1e3);
+  n += snprintf(buf+n, sizeof(buf)-n, "}}\n");
+  conn_send(c, buf, n);
+}
+
+/* Parse and queue a "solve" request
+ *
+ * @param d Daemon
+ * @param c Connection it came on
+ * @param args The rest of the line after "solve"
+ * @param id Default id of the job, replaced by id= of the request
+ * @return NULL if the job was queued, what is wrong with it otherwise
+*/
+const char *queue_job(daemon_t *d, conn *c, char *args, long *id)
+{
+  char *save = NULL;
+  char *hex = strtok_r(args, " \t", &save);
+  char *opt, *end;
+  int alpha = d->alpha, priority = 0;
+  double deadline_ms = 0;
+  int l;
+
+  while((opt = strtok_r(NULL, " \t", &save)) != NULL)
+  {
+    if(strncmp(opt, "id=", 3) == 0)
+      *id = atol(opt+3);
+    else if(strncmp(opt, "alpha=", 6) == 0)
+      alpha = atoi(opt+6);
+    else if(strncmp(opt, "priority=", 9) == 0)
+      priority = atoi(opt+9);
+    else if(strncmp(opt, "deadline=", 9) == 0)
+    {
+      deadline_ms = strtod(opt+9, &end);
+      if(end == opt+9 || *end != 0 || !isfinite(deadline_ms))
+        return "malformed deadline";
+    }
+    else
+      return "unknown option";
+  }
+  if(hex == NULL || strlen(hex) % 2 != 0 || strlen(hex) < 2)
+    return "malformed keystream";
+  if(recovery_select(alpha) == NULL)
+    return "unsupported alpha";
+  if(deadline_ms < 0)
+    return "negative deadline";
+
+  job *jb = (job *)malloc(sizeof(job));
+  if(jb == NULL || (jb->z = (uint8_t *)malloc(strlen(hex)/2)) == NULL)
+  {
+    free(jb);
+    return "out of memory";
+  }
+  jb->z_len = strlen(hex)/2;
+  if(fromHex(jb->z, (uint8_t *)hex, jb->z_len, 0) < 0)
+  {
+    free(jb->z);
+    free(jb);
+    return "malformed keystream";
+  }
+  for(l=0;l<jb->z_len;l++)
+    if(jb->z[l] >= (1<<alpha))
+    {
+      free(jb->z);
+      free(jb);
+      return "keystream value out of range for the word size";
+    }
+  jb->c = c;
+  jb->id = *id;
+  jb->priority = priority;
+  jb->alpha = alpha;
+  jb->arrived = now();
+  jb->deadline = deadline_ms > 0 ? jb->arrived + deadline_ms*1e-3 : 0;
+
+  conn_retain(c);
+  pthread_mutex_lock(&d->lock);
+  if(d->queued == d->max_queue)
+  {
+    d->rejected++;
+    pthread_mutex_unlock(&d->lock);
+    conn_release(c);
+    free(jb->z);
+    free(jb);
+    return "queue full";
+  }
+  jb->seq = d->seq++;
+  heap_push(d, jb);
+  d->accepted++;
+  pthread_cond_signal(&d->work);
+  if(jb->deadline > 0)
+    pthread_cond_signal(&d->watch);
+  pthread_mutex_unlock(&d->lock);
+  return NULL;
+}
+
+struct reader_struct
+{
+  daemon_t *d;
+  conn *c;
+};
+
+/* Connection thread: read requests until the client hangs up */
+void *reader_main(void *arg)
+{
+  struct reader_struct *r = (struct reader_struct *)arg;
+  daemon_t *d = r->d;
+  conn *c = r->c;
+  FILE *in = fdopen(dup(c->fd), "r"); // the socket itself stays open for the answers
+  char *line = (char *)malloc(MAX_REQUEST+2); // a request, its newline and the \0
+  long njobs = 0;
+  int ch;
+
+  free(r);
+  while(in != NULL && line != NULL && fgets(line, MAX_REQUEST+2, in) != NULL)
+  {
+    size_t n = strlen(line);
+    int too_long = n == MAX_REQUEST+1 && line[n-1] != '\n';
+    if(too_long) // drop the rest of the line without keeping it
+      while((ch = getc(in)) != EOF && ch != '\n')
+        ;
+    while(n > 0 && (line[n-1] == '\n' || line[n-1] == '\r' || line[n-1] == ' ' || line[n-1] == '\t'))
+      line[--n] = 0;
+    if(n == 0 || line[0] == '#')
+      continue;
+    if(strcmp(line, "stats") == 0)
+      send_stats(d, c);
+    else if(strncmp(line, "solve ", 6) == 0)
+    {
+      long id = njobs++;
+      const char *error = too_long ? "request too long" : queue_job(d, c, line+6, &id);
+      if(error != NULL)
+      {
+        pthread_mutex_lock(&d->lock);
+        d->errors += strcmp(error, "queue full") != 0; // those are counted as rejected
+        pthread_mutex_unlock(&d->lock);
+        send_error(c, id, error);
+      }
+    }
+    else
+    {
+      pthread_mutex_lock(&d->lock);
+      d->errors++;
+      pthread_mutex_unlock(&d->lock);
+      send_error(c, -1, too_long ? "request too long" : "unknown request");
+    }
+  }
+  free(line);
+  if(in != NULL)
+    fclose(in);
+  conn_release(c);
+  return NULL;
+}
+
+/* Listen on <path>, replacing a stale socket but not a running daemon
+ *
+ * @return Socket, -1 on error (reported to stderr)
+*/
+int listen_on(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd = daemon_connect(path);
+
+  if(fd >= 0)
+  {
+    close(fd);
+    fprintf(stderr, "A daemon is already listening on %s\n", path);
+    return -1;
+  }
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  unlink(path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+  {
+    fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void usage()
+{
+  printf("Serve RC4 state recovery jobs over a Unix socket (protocol in daemon.h)\n\n");
+  printf("Usage: recovery-daemon [--socket PATH] [--alpha N] [--queue N] [-l K] [-j THREADS]\n");
+  printf("          --socket PATH	socket to listen on (default %s)\n", DEFAULT_SOCKET);
+  printf("          --alpha N	word size of the jobs without alpha=, %d..%d (default %d)\n", ALPHA_MIN, ALPHA_MAX, DEFAULT_ALPHA);
+  printf("          --queue N	jobs waiting for a worker before new ones are refused (default %d)\n", DEFAULT_QUEUE);
+  printf("          -l K		check the next K keystream bytes for each candidate (default 0)\n");
+  printf("          -j THREADS	number of worker threads, one job each (default 1)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option long_options[] =
+  {
+    {"socket", required_argument, 0, 'S'},
+    {"alpha", required_argument, 0, 'A'},
+    {"queue", required_argument, 0, 'Q'},
+    {0, 0, 0, 0}
+  };
+  const char *path = DEFAULT_SOCKET;
+  daemon_t d;
+  int opt, l;
+
+  memset(&d, 0, sizeof(d));
+  d.nworkers = 1;
+  d.alpha = DEFAULT_ALPHA;
+  d.max_queue = DEFAULT_QUEUE;
+  while((opt = getopt_long(argc, argv, "l:j:", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 'S': path = optarg; break;
+      case 'A': d.alpha = atoi(optarg); break;
+      case 'Q': d.max_queue = atoi(optarg); break;
+      case 'l': d.lookahead = atoi(optarg); break;
+      case 'j': d.nworkers = atoi(optarg); break;
+      default: usage();
+    }
+  }
+  if(optind != argc || recovery_select(d.alpha) == NULL || d.max_queue < 1 || d.nworkers < 1 || d.lookahead < 0)
+    usage();
+
+  int fd = listen_on(path);
+  if(fd < 0)
+    return 1;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_stop; // no SA_RESTART: accept() returns on the signal
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC); // deadlines are on the monotonic clock
+  pthread_mutex_init(&d.lock, NULL);
+  pthread_cond_init(&d.work, NULL);
+  pthread_cond_init(&d.watch, &ca);
+  d.heap = (job **)malloc(d.max_queue*sizeof(job *));
+  d.expired = (job **)malloc(d.max_queue*sizeof(job *));
+  d.workers = (worker *)calloc(d.nworkers, sizeof(worker));
+  if(d.heap == NULL || d.expired == NULL || d.workers == NULL)
+  {
+    printf("Out of memory\n");
+    exit(-1);
+  }
+  d.started = now();
+  pthread_t watchdog;
+  for(l=0;l<d.nworkers;l++)
+  {
+    d.workers[l].d = &d;
+    pthread_create(&d.workers[l].thread, NULL, worker_main, &d.workers[l]);
+  }
+  pthread_create(&watchdog, NULL, watchdog_main, &d);
+  fprintf(stderr, "Listening on %s (RC4-%d by default, %d threads)\n", path, 1<<d.alpha, d.nworkers);
+
+  while(!stop_requested)
+  {
+    int cfd = accept(fd, NULL, NULL);
+    if(cfd < 0)
+    {
+      if(errno != EINTR)
+        perror("accept");
+      continue;
+    }
+    conn *c = (conn *)malloc(sizeof(conn));
+    struct reader_struct *r = (struct reader_struct *)malloc(sizeof(struct reader_struct));
+    if(c == NULL || r == NULL)
+    {
+      close(cfd);
+      free(c);
+      free(r);
+      continue;
+    }
+    c->fd = cfd;
+    c->refs = 1; // the reader's
+    pthread_mutex_init(&c->lock, NULL);
+    r->d = &d;
+    r->c = c;
+    pthread_t reader;
+    if(pthread_create(&reader, NULL, reader_main, r) != 0)
+    {
+      conn_release(c);
+      free(r);
+      continue;
+    }
+    pthread_detach(reader);
+  }
+
+  // The jobs still queued or running are dropped with the process
+  close(fd);
+  unlink(path);
+  pthread_mutex_lock(&d.lock);
+  fprintf(stderr, "Stopped: %ld jobs done (%ld solved, %ld timeouts, %ld errors), %ld refused, %d left in the queue\n",
+          d.done, d.solved, d.timeouts, d.errors, d.rejected, d.queued);
+  pthread_mutex_unlock(&d.lock);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Protocol of recovery-daemon
+ *
+ * Clients connect to a Unix stream socket and send one request per line:
+ *
+ *   solve HEX [id=N] [alpha=A] [priority=P] [deadline=MS]
+ *   stats
+ *
+ * "solve" queues a keystream (hex, like on the command line of
+ * state-recovery). Jobs with a higher priority run first (default 0), jobs
+ * of the same priority in the order they arrived. A job that is not done
+ * <deadline> milliseconds after it arrived is stopped (or never started)
+ * and answered with "timeout":1. Every request gets one JSON line back;
+ * the answers to "solve" come in completion order and carry the id of
+ * the request (default: its position on the connection, from 0):
+ *
+ *   {"id":0,"found":1,"queue_ms":0.012,"ms":1.234,"nodes":1234,"t":39,"i":8,"j":3,"s":[...]}
+ *   {"id":1,"found":0,"timeout":1,"queue_ms":0.010,"ms":50.002,"nodes":901120}
+ *   {"id":2,"error":"queue full"}
+ *   {"queued":0,"running":1,"workers":4,...,"latency_ms":{"p50":...}}
+ *
+ * "ms" is the time from arrival to answer, "queue_ms" the part of it the
+ * job waited for a worker.
+*/
+
+// Socket of the daemon if none is given
+#define DEFAULT_SOCKET "/tmp/rc4-recovery.sock"
+// Longest request line accepted (a keystream of about 32K bytes)
+#define MAX_REQUEST (1<<16)
+
+/* Connect to the daemon at <path>
+ *
+ * @return Socket, -1 on error (errno is set)
+*/
+static inline int daemon_connect(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+#endif // __DAEMON_H__
@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include "rc4prga.h"
+#include "recovery.h"
+#include "keysearch.h"
+
+/* Brute-force key search
+ *
+ * For short keys enumerating the keyspace is cheaper than backtracking the
+ * state: a key costs one key schedule and, almost always, a single keystream
+ * byte, since a wrong key is rejected at the first byte that differs from
+ * the keystream. rc4_init() only uses the key bytes modulo SIZE, so there
+ * are SIZE^key_len keys; key number n has the ALPHA bit digits of n as its
+ * bytes, most significant first.
+ *
+ * Keys are tested RC4_LANES at a time with the multi-lane kernels. Worker
+ * threads take blocks of KEY_BLOCK consecutive keys from a shared counter
+ * until the keyspace is exhausted or, unless all keys are wanted, one of
+ * them finds a key.
+*/
+
+// Keys taken by a worker at a time, a multiple of RC4_LANES
+#define KEY_BLOCK (1<<14)
+
+/* State shared by the workers of one key search */
+struct key_search_struct
+{
+  struct keysearch_params *p;
+  uint64_t nkeys; // size of the keyspace
+  _Atomic uint64_t next; // first key of the next block
+  atomic_int stop; // set when the search is done
+  atomic_llong tested; // keys tested by the workers that are done
+  pthread_mutex_t lock; // protects <found>, <res> and the callback
+  long found;
+  struct keysearch_result *res;
+};
+
+typedef struct key_search_struct key_search_t;
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Bytes of key number <n> */
+static void key_digits(uint64_t n, int key_len, uint8_t *key)
+{
+  int b;
+  for(b=key_len-1;b>=0;b--)
+  {
+    key[b] = n & (SIZE-1);
+    n >>= ALPHA;
+  }
+}
+
+/* State of <key> at keystream byte <z_len>-1, in the format of the state recovery */
+static void key_state(uint8_t *key, int key_len, int z_len, struct recovery_result *res)
+{
+  uint8_t s[SIZE];
+  int i = 0, j = 0, t, x;
+
+  rc4_init(key, key_len, s);
+  for(t=0;t<z_len;t++)
+  {
+    i = ind(i+1);
+    rc4_step(s, i, &j);
+  }
+  memset(res, 0, sizeof(*res));
+  res->size = SIZE;
+  for(x=0;x<SIZE;x++)
+  {
+    res->s[x] = s[x];
+    res->inv_s[s[x]] = x;
+  }
+  res->i = i;
+  res->j = j;
+  res->t = z_len-1;
+}
+
+/* Record a key which produces the whole keystream
+ *
+ * @return 1 if the search should stop
+*/
+static int report_key(key_search_t *ks, uint8_t *key)
+{
+  struct keysearch_params *p = ks->p;
+  struct recovery_result state;
+  int stop = !p->all;
+
+  key_state(key, p->key_len, p->z_len, &state);
+  pthread_mutex_lock(&ks->lock);
+  if(!p->all && atomic_load(&ks->stop))
+  {
+    pthread_mutex_unlock(&ks->lock);
+    return 1; // another worker was first
+  }
+  if(ks->found++ == 0)
+  {
+    memcpy(ks->res->key, key, p->key_len);
+    ks->res->state = state;
+  }
+  if(p->all && p->on_key != NULL && p->on_key(key, p->key_len, &state, p->arg))
+    stop = 1;
+  if(stop)
+    atomic_store(&ks->stop, 1);
+  pthread_mutex_unlock(&ks->lock);
+  return stop;
+}
+
+/* Test keys <first> .. <first>+<n>-1 against the keystream
+ *
+ * @param z Keystream
+ * @param z_len Its length
+ * @param key_len Key length
+ * @param first First key
+ * @param n Number of keys, a multiple of RC4_LANES (keys past the keyspace
+ *          wrap around and are simply tested twice)
+ * @param ks Search to report matches to, NULL to only test
+ * @return 1 if the search should stop
+*/
+static int test_keys(uint8_t *z, int z_len, int key_len, uint64_t first, uint64_t n, key_search_t *ks)
+{
+  struct rc4_lanes st;
+  uint8_t keys[RC4_LANES][KEYSEARCH_MAX_KEY];
+  uint8_t *lane_keys[RC4_LANES];
+  int keylens[RC4_LANES];
+  uint8_t out[RC4_LANES];
+  uint64_t k;
+  int l, t;
+
+  for(l=0;l<RC4_LANES;l++)
+  {
+    lane_keys[l] = keys[l];
+    keylens[l] = key_len;
+  }
+  for(k=first;k<first+n;k+=RC4_LANES)
+  {
+    for(l=0;l<RC4_LANES;l++)
+      key_digits(k+l, key_len, keys[l]);
+    rc4_init_lanes(lane_keys, keylens, &st);
+    int alive = (1<<RC4_LANES)-1; // lanes that matched the keystream so far
+    for(t=0;t<z_len && alive;t++)
+    {
+      rc4_prga_lanes(&st, out, 1);
+      for(l=0;l<RC4_LANES;l++)
+        if(out[l] != z[t])
+          alive &= ~(1<<l);
+    }
+    for(l=0;l<RC4_LANES && ks != NULL;l++)
+      if(((alive >> l) & 1) && k+l < ks->nkeys) // skip the padding of a keyspace smaller than RC4_LANES
+        if(report_key(ks, keys[l]))
+          return 1;
+  }
+  return 0;
+}
+
+/* Worker thread: test blocks of keys until the keyspace is exhausted
+ * or the search is stopped
+*/
+static void *key_worker(void *arg)
+{
+  key_search_t *ks = (key_search_t *)arg;
+  struct keysearch_params *p = ks->p;
+  uint64_t tested = 0;
+
+  while(!atomic_load_explicit(&ks->stop, memory_order_relaxed))
+  {
+    uint64_t first = atomic_fetch_add(&ks->next, KEY_BLOCK);
+    if(first >= ks->nkeys)
+      break;
+    uint64_t n = ks->nkeys - first < KEY_BLOCK ? ks->nkeys - first : KEY_BLOCK;
+    n = (n + RC4_LANES-1) / RC4_LANES * RC4_LANES;
+    tested += n;
+    if(test_keys(p->z, p->z_len, p->key_len, first, n, ks))
+      break;
+  }
+  atomic_fetch_add(&ks->tested, tested);
+  return NULL;
+}
+
+/**
+ * Search the keyspace for keys that produce a keystream
+ *
+ * @param p What to search for (keystream and key length) and how
+ * @param res The first key found, its state and the work done go here
+ * @return Number of keys found (at most 1 unless p->all is set)
+*/
+long key_search(struct keysearch_params *p, struct keysearch_result *res)
+{
+  key_search_t ks;
+  int l;
+
+  memset(res, 0, sizeof(*res));
+  res->key_len = p->key_len;
+  ks.p = p;
+  ks.nkeys = keysearch_keyspace(ALPHA, p->key_len);
+  atomic_init(&ks.next, 0);
+  atomic_init(&ks.stop, 0);
+  atomic_init(&ks.tested, 0);
+  pthread_mutex_init(&ks.lock, NULL);
+  ks.found = 0;
+  ks.res = res;
+  if(ks.nkeys > 0 && p->z_len >= 1) // nothing to search otherwise
+  {
+    double t0 = now();
+    if(p->nworkers <= 1)
+      key_worker(&ks);
+    else
+    {
+      pthread_t *threads = (pthread_t *)malloc(p->nworkers*sizeof(pthread_t));
+      for(l=0;l<p->nworkers;l++)
+        pthread_create(&threads[l], NULL, key_worker, &ks);
+      for(l=0;l<p->nworkers;l++)
+        pthread_join(threads[l], NULL);
+      free(threads);
+    }
+    res->seconds = now() - t0;
+    res->keys = atomic_load(&ks.tested);
+  }
+  pthread_mutex_destroy(&ks.lock);
+  return ks.found;
+}
+
+const struct keysearch_kernels ALPHA_NAME(keysearch_kernels) = { ALPHA, key_search };
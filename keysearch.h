@@ -0,0 +1,81 @@
+#ifndef __KEYSEARCH_H__
+#define __KEYSEARCH_H__
+
+#include <stdint.h>
+#include "recovery.h"
+
+// Longest key the key search enumerates (the keyspace must also fit into 62 bits)
+#define KEYSEARCH_MAX_KEY (32)
+
+/* Called for every key found in exhaustive mode (under a lock, so it is
+ * never called concurrently); <state> is the state at the last keystream
+ * byte. Return non-zero to stop the search */
+typedef int (*key_callback)(uint8_t *key, int key_len, struct recovery_result *state, void *arg);
+
+/* What to search for and how */
+struct keysearch_params
+{
+  uint8_t *z; // keystream, starting with the first byte after the key schedule
+  int z_len; // lenght of the keystream
+  int key_len; // key length in bytes; only the bytes modulo SIZE matter, so every byte is below SIZE
+  int nworkers; // number of threads
+  int all; // if set, find all keys which produce the keystream instead of stopping at the first
+  key_callback on_key; // exhaustive mode: receives each key as it is found
+  void *arg; // passed to <on_key>
+};
+
+/* Result of a key search */
+struct keysearch_result
+{
+  uint8_t key[KEYSEARCH_MAX_KEY]; // the first key found
+  int key_len;
+  struct recovery_result state; // state of the first key at the last keystream byte
+  uint64_t keys; // keys tested
+  double seconds; // time of the search
+};
+
+/* Key search for one word size */
+struct keysearch_kernels
+{
+  int alpha;
+  long (*search)(struct keysearch_params *p, struct keysearch_result *res); // key_search()
+};
+
+extern const struct keysearch_kernels keysearch_kernels_a3;
+extern const struct keysearch_kernels keysearch_kernels_a4;
+extern const struct keysearch_kernels keysearch_kernels_a5;
+extern const struct keysearch_kernels keysearch_kernels_a6;
+extern const struct keysearch_kernels keysearch_kernels_a7;
+extern const struct keysearch_kernels keysearch_kernels_a8;
+
+/* Get the key search for word size <alpha>, NULL if it is not supported
+*/
+static inline const struct keysearch_kernels *keysearch_select(int alpha)
+{
+  switch(alpha)
+  {
+    case 3: return &keysearch_kernels_a3;
+    case 4: return &keysearch_kernels_a4;
+    case 5: return &keysearch_kernels_a5;
+    case 6: return &keysearch_kernels_a6;
+    case 7: return &keysearch_kernels_a7;
+    case 8: return &keysearch_kernels_a8;
+  }
+  return NULL;
+}
+
+/* Number of keys of <key_len> bytes for word size <alpha>, 0 if it does not fit into 62 bits */
+static inline uint64_t keysearch_keyspace(int alpha, int key_len)
+{
+  if(key_len < 1 || key_len > KEYSEARCH_MAX_KEY || alpha*key_len > 62)
+    return 0;
+  return 1ULL << (alpha*key_len);
+}
+
+#ifdef ALPHA
+#define key_search ALPHA_NAME(key_search)
+
+long key_search(struct keysearch_params *p, struct keysearch_result *res);
+#endif // ALPHA
+
+#endif // __KEYSEARCH_H__
@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "util.h" // convert from binary to hex
+#include "rc4prga.h"
+#include "bench.h"
+#include "daemon.h"
+
+#ifndef DEFAULT_ALPHA
+  #define DEFAULT_ALPHA (4)
+#endif
+
+/* Load generator for recovery-daemon
+ *
+ * Sends the keystreams of <jobs> random keys (fixed seed, the same keys
+ * for the same options) over one connection, either keeping <concurrency>
+ * jobs in flight (closed loop) or at a fixed <rate> (open loop, which
+ * shows the queueing delay once the daemon falls behind). The latency of
+ * a job is measured from sending its request to reading its answer.
+*/
+
+#define DEFAULT_JOBS (1000)
+#define DEFAULT_LEN (40)
+
+struct load_struct
+{
+  int fd;
+  char **requests; // one "solve" line per job
+  int jobs;
+  int concurrency; // jobs in flight with the closed loop
+  double rate; // jobs per second with the open loop, 0 for the closed loop
+  double *sent; // when each request went out
+  pthread_mutex_t lock; // protects <inflight> and <sent>
+  pthread_cond_t room; // a job was answered
+  int inflight;
+};
+
+typedef struct load_struct load;
+
+/* Seconds on the monotonic clock */
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Write all of <buf> to <fd>
+ *
+ * @return 0, -1 on error
+*/
+int write_all(int fd, const char *buf, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Sender thread: send the requests on the schedule */
+void *sender_main(void *arg)
+{
+  load *ld = (load *)arg;
+  double start = now();
+  int l;
+
+  for(l=0;l<ld->jobs;l++)
+  {
+    pthread_mutex_lock(&ld->lock);
+    if(ld->rate > 0)
+    {
+      pthread_mutex_unlock(&ld->lock);
+      double wait = start + l/ld->rate - now();
+      if(wait > 0)
+      {
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - ts.tv_sec)*1e9);
+        nanosleep(&ts, NULL);
+      }
+      pthread_mutex_lock(&ld->lock);
+    }
+    else
+      while(ld->inflight >= ld->concurrency)
+        pthread_cond_wait(&ld->room, &ld->lock);
+    ld->inflight++;
+    ld->sent[l] = now();
+    pthread_mutex_unlock(&ld->lock);
+    if(write_all(ld->fd, ld->requests[l], strlen(ld->requests[l])) < 0)
+      break;
+  }
+  return NULL;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void usage()
+{
+  printf("Load generator for recovery-daemon\n\n");
+  printf("Usage: recovery-load [--socket PATH] [--alpha N] [-n JOBS] [-L LEN] [-c CONCURRENCY | -r RATE]\n");
+  printf("                     [--priority P] [--deadline MS] [--seed S]\n");
+  printf("          --socket PATH	socket of the daemon (default %s)\n", DEFAULT_SOCKET);
+  printf("          --alpha N	word size, %d..%d (default %d)\n", ALPHA_MIN, ALPHA_MAX, DEFAULT_ALPHA);
+  printf("          -n JOBS	number of jobs (default %d)\n", DEFAULT_JOBS);
+  printf("          -L LEN	keystream bytes per job (default %d)\n", DEFAULT_LEN);
+  printf("          -c CONCURRENCY	jobs in flight (default 1)\n");
+  printf("          -r RATE	send RATE jobs per second instead, whether answered or not\n");
+  printf("          --priority P	priority of the jobs (default 0)\n");
+  printf("          --deadline MS	deadline of the jobs (default: none)\n");
+  printf("          --seed S	seed of the keys (default 1)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option long_options[] =
+  {
+    {"socket", required_argument, 0, 'S'},
+    {"alpha", required_argument, 0, 'A'},
+    {"priority", required_argument, 0, 'P'},
+    {"deadline", required_argument, 0, 'D'},
+    {"seed", required_argument, 0, 's'},
+    {0, 0, 0, 0}
+  };
+  const char *path = DEFAULT_SOCKET;
+  int alpha = DEFAULT_ALPHA;
+  int z_len = DEFAULT_LEN;
+  int priority = 0;
+  double deadline = 0;
+  uint64_t seed = 1;
+  load ld;
+  int opt, l, n;
+
+  memset(&ld, 0, sizeof(ld));
+  ld.jobs = DEFAULT_JOBS;
+  ld.concurrency = 1;
+  while((opt = getopt_long(argc, argv, "n:L:c:r:", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 'S': path = optarg; break;
+      case 'A': alpha = atoi(optarg); break;
+      case 'P': priority = atoi(optarg); break;
+      case 'D': deadline = atof(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case 'n': ld.jobs = atoi(optarg); break;
+      case 'L': z_len = atoi(optarg); break;
+      case 'c': ld.concurrency = atoi(optarg); break;
+      case 'r': ld.rate = atof(optarg); break;
+      default: usage();
+    }
+  }
+  const struct rc4_kernels *rk = rc4_select(alpha);
+  if(optind != argc || rk == NULL || ld.jobs < 1 || z_len < 1 || z_len > MAX_REQUEST/2 - 64 || ld.concurrency < 1 || ld.rate < 0)
+    usage();
+
+  // The requests are ready before the clock starts
+  int size = 1<<alpha;
+  uint8_t s[MAX_SIZE];
+  uint8_t key[16];
+  uint8_t *z = (uint8_t *)malloc(z_len);
+  uint8_t *hex = (uint8_t *)malloc(2*z_len+1);
+  ld.requests = (char **)malloc(ld.jobs*sizeof(char *));
+  ld.sent = (double *)malloc(ld.jobs*sizeof(double));
+  double *latency = (double *)malloc(ld.jobs*sizeof(double));
+  int *answered = (int *)calloc(ld.jobs, sizeof(int));
+  for(n=0;n<ld.jobs;n++)
+  {
+    int i, j = 0;
+    for(l=0;l<sizeof(key);l++)
+      key[l] = bench_rand(&seed);
+    rk->ksa(key, sizeof(key), s);
+    for(i=1;i<=z_len;i++)
+      z[i-1] = rk->prga(s, i&(size-1), &j);
+    toHex(hex, z, z_len, 0);
+    ld.requests[n] = (char *)malloc(2*z_len + 96);
+    l = sprintf(ld.requests[n], "solve %s id=%d alpha=%d priority=%d", (char *)hex, n, alpha, priority);
+    if(deadline > 0)
+      l += sprintf(ld.requests[n]+l, " deadline=%g", deadline);
+    sprintf(ld.requests[n]+l, "\n");
+  }
+
+  ld.fd = daemon_connect(path);
+  if(ld.fd < 0)
+  {
+    fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  FILE *in = fdopen(dup(ld.fd), "r");
+  pthread_mutex_init(&ld.lock, NULL);
+  pthread_cond_init(&ld.room, NULL);
+  double t0 = now();
+  pthread_t sender;
+  pthread_create(&sender, NULL, sender_main, &ld);
+
+  char *line = NULL;
+  size_t cap = 0;
+  int got = 0, solved = 0, timeouts = 0, errors = 0;
+  while(got < ld.jobs && getline(&line, &cap, in) >= 0)
+  {
+    double t = now();
+    long id;
+    if(sscanf(line, "{\"id\":%ld", &id) != 1 || id < 0 || id >= ld.jobs || answered[id])
+      continue;
+    pthread_mutex_lock(&ld.lock);
+    latency[got++] = t - ld.sent[id];
+    ld.inflight--;
+    pthread_cond_signal(&ld.room);
+    pthread_mutex_unlock(&ld.lock);
+    answered[id] = 1;
+    if(strstr(line, "\"error\"") != NULL)
+      errors++;
+    else if(strstr(line, "\"timeout\":1") != NULL)
+      timeouts++;
+    else if(strstr(line, "\"found\":1") != NULL)
+      solved++;
+  }
+  double secs = now() - t0;
+  pthread_join(sender, NULL);
+
+  qsort(latency, got, sizeof(double), cmp_double);
+  printf("Sent %d jobs (RC4-%d, %d bytes) in %.3f s: %d answered, %d solved, %d timeouts, %d errors, %.1f jobs/s\n",
+         ld.jobs, size, z_len, secs, got, solved, timeouts, errors, secs > 0 ? got/secs : 0);
+  if(got > 0)
+    printf("Latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", latency[(int)(0.5*(got-1) + 0.5)]*1e3,
+           latency[(int)(0.9*(got-1) + 0.5)]*1e3, latency[(int)(0.99*(got-1) + 0.5)]*1e3, latency[got-1]*1e3);
+
+  // The daemon's view of the run
+  if(write_all(ld.fd, "stats\n", 6) == 0 && getline(&line, &cap, in) >= 0)
+    printf("Daemon: %s", line);
+
+  free(line);
+  fclose(in);
+  close(ld.fd);
+  for(n=0;n<ld.jobs;n++)
+    free(ld.requests[n]);
+  free(ld.requests);
+  free(ld.sent);
+  free(latency);
+  free(answered);
+  free(z);
+  free(hex);
+  return got < ld.jobs;
+}
@@ -53,3 +53,118 @@ uint8_t rc4_step(uint8_t *s, int i, int *j)
    *j = a;
    return r;
 }
+
+/* Multi-lane kernels
+ *
+ * RC4_LANES states are advanced together. A step of one state depends on
+ * the previous one through j and the permutation, so a single state keeps
+ * the CPU waiting on loads; the lanes are independent, and interleaving
+ * their steps lets the loads and swaps of different lanes overlap.
+ *
+ * Every lane keeps its own contiguous permutation: with the lanes' entries
+ * interleaved, a store to one lane looks to the CPU like it may feed the
+ * next lane's load, which serializes them again.
+*/
+
+#if RC4_LANES != 4
+#error "rc4_init_lanes() and rc4_prga_lanes() are unrolled for 4 lanes"
+#endif
+
+// One key schedule step of lane <l>, with the key repeated to SIZE bytes in k[l]
+#define KSA_STEP(l) do { \
+    uint8_t x = s[l][i]; \
+    uint8_t jl = ind(j##l + x + k[l][i]); \
+    s[l][i] = s[l][jl]; s[l][jl] = x; \
+    j##l = jl; \
+  } while(0)
+
+// One step of lane <l>, keystream byte goes to out[l*len+t]
+#define LANE_STEP(l) do { \
+    uint8_t x = s[l][i]; \
+    uint8_t jl = ind(j##l + x); \
+    uint8_t y = s[l][jl]; \
+    s[l][i] = y; s[l][jl] = x; \
+    j##l = jl; \
+    out[(l)*len+t] = s[l][ind(x+y)]; \
+  } while(0)
+
+/**
+ * Initialize RC4_LANES states, like rc4_init() for each lane
+ *
+ * @param keys Key of every lane
+ * @param keylens Key length of every lane
+ * @param st The states are written here, i and j are reset
+ * @return none
+*/
+void rc4_init_lanes(uint8_t **keys, int *keylens, struct rc4_lanes *st)
+{
+  uint8_t (* restrict s)[MAX_SIZE] = st->s;
+  uint8_t k[RC4_LANES][SIZE];
+  uint8_t j0 = 0, j1 = 0, j2 = 0, j3 = 0;
+  int i, l, m;
+
+  for(l=0;l<RC4_LANES;l++)
+  {
+    // the key repeated to SIZE bytes, so the steps need no modulo
+    m = keylens[l] < SIZE ? keylens[l] : SIZE;
+    memcpy(k[l], keys[l], m);
+    for(;m<SIZE;m*=2)
+      memcpy(k[l]+m, k[l], m < SIZE-m ? m : SIZE-m);
+    for(i=0;i<SIZE;i++)
+      s[l][i] = i;
+  }
+  for(i=0;i<SIZE;i++)
+  {
+    KSA_STEP(0);
+    KSA_STEP(1);
+    KSA_STEP(2);
+    KSA_STEP(3);
+  }
+  for(l=0;l<RC4_LANES;l++)
+    st->j[l] = 0;
+  st->i = 0;
+}
+
+/**
+ * Generate the next <len> keystream bytes of every lane
+ *
+ * @param st States from rc4_init_lanes(), advanced by <len> steps
+ * @param out Keystream of lane l goes to out[l*len] .. out[l*len+len-1]
+ * @param len Number of bytes per lane
+ * @return none
+*/
+void rc4_prga_lanes(struct rc4_lanes *st, uint8_t *out, int len)
+{
+  uint8_t (* restrict s)[MAX_SIZE] = st->s;
+  uint8_t j0 = st->j[0], j1 = st->j[1], j2 = st->j[2], j3 = st->j[3];
+  int i = st->i;
+  int t;
+
+  for(t=0;t<len;t++)
+  {
+    i = ind(i+1);
+    LANE_STEP(0);
+    LANE_STEP(1);
+    LANE_STEP(2);
+    LANE_STEP(3);
+  }
+  st->j[0] = j0; st->j[1] = j1; st->j[2] = j2; st->j[3] = j3;
+  st->i = i;
+}
+
+/**
+ * Copy the state of one lane out, in the layout of rc4_init()/rc4_step()
+ *
+ * @param st States
+ * @param lane Lane to copy
+ * @param s The permutation goes here
+ * @param j The value of j goes here
+ * @return none
+*/
+void rc4_get_lane(struct rc4_lanes *st, int lane, uint8_t *s, int *j)
+{
+  memcpy(s, st->s[lane], SIZE);
+  *j = st->j[lane];
+}
+
+const struct rc4_kernels ALPHA_NAME(rc4_kernels) = { ALPHA, rc4_init, rc4_step, rc4_init_lanes, rc4_prga_lanes, rc4_get_lane };
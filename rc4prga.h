@@ -1,17 +1,89 @@
 #ifndef __RC4PRGA_H__
 #define __RC4PRGA_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
- * SIZE is (1<<ALPHA) = (1 times 2 to the 8th) = 256.
- * ind(x) is the low order 8 bits of x, or x mod 256.
+ * Supported word sizes. Kernels are compiled once per word size
+ * (-DALPHA=n) and their symbols get an _a<n> suffix, see ALPHA_NAME().
+ * Code compiled without ALPHA picks the kernels at run time.
+ */
+#define ALPHA_MIN  (3)
+#define ALPHA_MAX  (8)
+#define MAX_SIZE   (1<<ALPHA_MAX)
+
+#define ALPHA_CAT(name, a)  name##_a##a
+#define ALPHA_XCAT(name, a) ALPHA_CAT(name, a)
+#define ALPHA_NAME(name)    ALPHA_XCAT(name, ALPHA)
+
+// Number of RC4 states advanced together by the multi-lane kernels
+// (rc4_init_lanes() and rc4_prga_lanes() are unrolled for exactly this many)
+#define RC4_LANES (4)
+
+/* RC4_LANES independent RC4 states stepped together so that their steps can
+ * overlap (see rc4_prga_lanes()); all lanes share i
+*/
+struct rc4_lanes
+{
+  uint8_t s[RC4_LANES][MAX_SIZE]; // permutation of lane l is s[l]
+  uint8_t j[RC4_LANES];
+  int i;
+};
+
+/* RC4 kernels for one word size */
+struct rc4_kernels
+{
+  int alpha;
+  void (*ksa)(uint8_t *key, int keylen, uint8_t *s); // rc4_init()
+  uint8_t (*prga)(uint8_t *s, int i, int *j); // rc4_step()
+  void (*ksa_lanes)(uint8_t **keys, int *keylens, struct rc4_lanes *st); // rc4_init_lanes()
+  void (*prga_lanes)(struct rc4_lanes *st, uint8_t *out, int len); // rc4_prga_lanes()
+  void (*get_lane)(struct rc4_lanes *st, int lane, uint8_t *s, int *j); // rc4_get_lane()
+};
+
+extern const struct rc4_kernels rc4_kernels_a3;
+extern const struct rc4_kernels rc4_kernels_a4;
+extern const struct rc4_kernels rc4_kernels_a5;
+extern const struct rc4_kernels rc4_kernels_a6;
+extern const struct rc4_kernels rc4_kernels_a7;
+extern const struct rc4_kernels rc4_kernels_a8;
+
+/* Get RC4 kernels for word size <alpha>, NULL if it is not supported
+*/
+static inline const struct rc4_kernels *rc4_select(int alpha)
+{
+  switch(alpha)
+  {
+    case 3: return &rc4_kernels_a3;
+    case 4: return &rc4_kernels_a4;
+    case 5: return &rc4_kernels_a5;
+    case 6: return &rc4_kernels_a6;
+    case 7: return &rc4_kernels_a7;
+    case 8: return &rc4_kernels_a8;
+  }
+  return NULL;
+}
+
+#ifdef ALPHA
+/*
+ * SIZE is (1<<ALPHA), the size of the permutation (256 for ALPHA=8).
+ * ind(x) is the low order ALPHA bits of x, or x mod SIZE.
  */
-#ifndef ALPHA
-  #define ALPHA      (8)
-#endif
 #define SIZE       (1<<ALPHA)
 #define ind(x)     ((x)&(SIZE-1))
 
+#define rc4_init       ALPHA_NAME(rc4_init)
+#define rc4_step       ALPHA_NAME(rc4_step)
+#define rc4_init_lanes ALPHA_NAME(rc4_init_lanes)
+#define rc4_prga_lanes ALPHA_NAME(rc4_prga_lanes)
+#define rc4_get_lane   ALPHA_NAME(rc4_get_lane)
+
 void rc4_init(uint8_t *key, int keylen, uint8_t *s);
 uint8_t rc4_step(uint8_t *s, int i, int *j);
+void rc4_init_lanes(uint8_t **keys, int *keylens, struct rc4_lanes *st);
+void rc4_prga_lanes(struct rc4_lanes *st, uint8_t *out, int len);
+void rc4_get_lane(struct rc4_lanes *st, int lane, uint8_t *s, int *j);
+#endif // ALPHA
 
 #endif // __RC4PRGA_H__
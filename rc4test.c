@@ -3,57 +3,357 @@
 #include <alloca.h>
 #include <stdio.h>
 #include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
 #include "util.h" // convert from hex to binary
 #include "rc4prga.h"
 
 
+#ifndef DEFAULT_ALPHA
+  #define DEFAULT_ALPHA (4)
+#endif
+
 /* Print permutation
 */
-void print_permutation(uint8_t *s)
+void print_permutation(uint8_t *s, int size)
 {
   int l = 0;
 
   printf("Permuation:\n");
-  for(l=0;l<SIZE;l++)
+  for(l=0;l<size;l++)
     printf("% 3d ", l);
   printf("\n");
-  for(l=0;l<SIZE;l++)
+  for(l=0;l<size;l++)
     printf("% 3d ", s[l]);
 
   printf("\n");
   return;
 }
 
+/* Bulk mode
+ *
+ * Keys come from a file of hex lines or from a seeded generator (key <n>
+ * depends only on the seed and <n>, so the output does not depend on the
+ * number of threads). Threads take blocks of keys, generate their
+ * keystreams with the multi-lane kernels and write them in key order:
+ * <len> bytes per key, one byte per keystream value, nothing else. With
+ * --hex every keystream is a line of hex digits instead (the input of
+ * state-recovery --batch).
+*/
+
+#define BULK_BLOCK (4096) // keys per block, a multiple of RC4_LANES
+#define BULK_MAX_KEY (256)
+
+struct bulk_struct
+{
+  const struct rc4_kernels *k;
+  int len; // keystream bytes per key
+  int key_len; // length of generated keys
+  uint64_t seed;
+  long nkeys; // number of keys, -1 for all keys in <keys>
+  FILE *keys; // key file, NULL for generated keys
+  FILE *out;
+  int scalar; // use rc4_init()/rc4_step() instead of the multi-lane kernels
+  int hex; // write hex lines instead of raw bytes
+  pthread_mutex_t in_lock; // protects <keys> and <next_block>
+  long next_block;
+  long done; // keys read so far
+  pthread_mutex_t out_lock; // protects <out> and <next_write>
+  pthread_cond_t turn;
+  long next_write; // block to be written next
+};
+
+typedef struct bulk_struct bulk;
+
+static uint64_t splitmix(uint64_t *state)
+{
+  uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/* Take the next block of keys (under b->in_lock)
+ *
+ * @return Number of keys in the block, 0 if there are no more
+*/
+static int bulk_take(bulk *b, long *block, uint8_t (*keys)[BULK_MAX_KEY], int *keylens)
+{
+  int n = 0;
+  pthread_mutex_lock(&b->in_lock);
+  *block = b->next_block++;
+  if(b->keys == NULL)
+  {
+    long first = *block * BULK_BLOCK;
+    n = (b->nkeys - first < BULK_BLOCK) ? (int)(b->nkeys - first) : BULK_BLOCK;
+    if(n < 0)
+      n = 0;
+    int l, x;
+    for(l=0;l<n;l++)
+    {
+      uint64_t rnd = b->seed ^ ((uint64_t)(first + l) * 0xd1b54a32d192ed03ULL);
+      for(x=0;x<b->key_len;x++)
+        keys[l][x] = splitmix(&rnd);
+      keylens[l] = b->key_len;
+    }
+  }
+  else
+  {
+    char line[2*BULK_MAX_KEY+16];
+    while(n < BULK_BLOCK && (b->nkeys < 0 || b->done < b->nkeys) && fgets(line, sizeof(line), b->keys) != NULL)
+    {
+      int hex = strcspn(line, " \t\r\n");
+      if(hex == 0 || line[0] == '#')
+        continue;
+      if(hex%2 != 0 || hex > 2*BULK_MAX_KEY || fromHex(keys[n], (uint8_t *)line, hex/2, 0) < 0)
+      {
+        fprintf(stderr, "Bad key in line %ld of the key file\n", b->done+1);
+        exit(-1);
+      }
+      keylens[n++] = hex/2;
+      b->done++;
+    }
+  }
+  pthread_mutex_unlock(&b->in_lock);
+  return n;
+}
+
+static void *bulk_worker(void *arg)
+{
+  bulk *b = (bulk *)arg;
+  uint8_t (*keys)[BULK_MAX_KEY] = malloc(BULK_BLOCK*sizeof(*keys));
+  int *keylens = (int *)malloc(BULK_BLOCK*sizeof(int));
+  uint8_t *buf = (uint8_t *)malloc((size_t)BULK_BLOCK*b->len);
+  struct rc4_lanes *st = (struct rc4_lanes *)malloc(sizeof(struct rc4_lanes));
+  long block;
+  int n, g, l;
+
+  if(keys == NULL || keylens == NULL || buf == NULL || st == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(-1);
+  }
+  while((n = bulk_take(b, &block, keys, keylens)) > 0)
+  {
+    if(b->scalar)
+    {
+      uint8_t s[MAX_SIZE];
+      int size = 1<<b->k->alpha;
+      for(g=0;g<n;g++)
+      {
+        int i, j = 0;
+        b->k->ksa(keys[g], keylens[g], s);
+        for(i=1;i<=b->len;i++)
+          buf[(size_t)g*b->len+i-1] = b->k->prga(s, i&(size-1), &j);
+      }
+    }
+    else
+    {
+      for(g=n;g%RC4_LANES;g++) // pad the last group of lanes with copies of the first key
+      {
+        memcpy(keys[g], keys[0], keylens[0]);
+        keylens[g] = keylens[0];
+      }
+      for(g=0;g<n;g+=RC4_LANES)
+      {
+        uint8_t *lane_keys[RC4_LANES];
+        for(l=0;l<RC4_LANES;l++)
+          lane_keys[l] = keys[g+l];
+        b->k->ksa_lanes(lane_keys, keylens+g, st);
+        // the padding lanes still fit into buf, only n keystreams are written
+        b->k->prga_lanes(st, buf + (size_t)g*b->len, b->len);
+      }
+    }
+
+    pthread_mutex_lock(&b->out_lock);
+    while(b->next_write != block)
+      pthread_cond_wait(&b->turn, &b->out_lock);
+    if(b->hex)
+    {
+      for(g=0;g<n;g++)
+        if(writeHex(b->out, buf + (size_t)g*b->len, b->len, 0) < 0 || putc('\n', b->out) == EOF)
+        {
+          perror("write");
+          exit(-1);
+        }
+    }
+    else if(fwrite(buf, b->len, n, b->out) != (size_t)n)
+    {
+      perror("write");
+      exit(-1);
+    }
+    b->next_write++;
+    pthread_cond_broadcast(&b->turn);
+    pthread_mutex_unlock(&b->out_lock);
+  }
+
+  // let the writers of the blocks after ours go on
+  pthread_mutex_lock(&b->out_lock);
+  while(b->next_write != block)
+    pthread_cond_wait(&b->turn, &b->out_lock);
+  b->next_write++;
+  pthread_cond_broadcast(&b->turn);
+  pthread_mutex_unlock(&b->out_lock);
+
+  free(st);
+  free(buf);
+  free(keylens);
+  free(keys);
+  return NULL;
+}
+
+/* Generate the keystreams of many keys, see bulk_struct */
+int run_bulk(bulk *b, int nthreads)
+{
+  pthread_t *threads = (pthread_t *)malloc(nthreads*sizeof(pthread_t));
+  struct timespec t0, t1;
+  long total;
+  int l;
+
+  if(threads == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(-1);
+  }
+  pthread_mutex_init(&b->in_lock, NULL);
+  pthread_mutex_init(&b->out_lock, NULL);
+  pthread_cond_init(&b->turn, NULL);
+  b->next_block = b->next_write = b->done = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(l=0;l<nthreads;l++)
+    pthread_create(&threads[l], NULL, bulk_worker, b);
+  for(l=0;l<nthreads;l++)
+    pthread_join(threads[l], NULL);
+  fflush(b->out);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  total = (b->keys == NULL) ? b->nkeys : b->done;
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+  fprintf(stderr, "Generated %ld keystreams of %d bytes in %.3f s (%.2f M keystreams/s)\n",
+          total, b->len, secs, secs > 0 ? total/secs*1e-6 : 0);
+  pthread_cond_destroy(&b->turn);
+  pthread_mutex_destroy(&b->in_lock);
+  pthread_mutex_destroy(&b->out_lock);
+  free(threads);
+  return 0;
+}
+
+void usage()
+{
+  printf("Reduced RC4 key stream cipher (default ALPHA=%d bits, state size is %d)\n\n", DEFAULT_ALPHA, 1<<DEFAULT_ALPHA);
+  printf("Usage: rc4test [--alpha N] KEY LEN \n");
+  printf("       rc4test [--alpha N] --bulk --len LEN [-n COUNT] [--keys FILE | --seed S --key-len K] [-j THREADS] [-o FILE] [--scalar] [--hex]\n");
+  printf("          --alpha N	word size in bits, %d..%d\n", ALPHA_MIN, ALPHA_MAX);
+  printf("          KEY	encryption key (in hex)\n");
+  printf("          LEN	the lenght of the keystream to generate\n");
+  printf("          --bulk	write the keystreams of many keys as raw bytes, LEN per key, in key order\n");
+  printf("          -n COUNT	number of keys (default: all keys in FILE, required for generated keys)\n");
+  printf("          --keys FILE	read keys from FILE, one hex key per line (- for stdin)\n");
+  printf("          --seed S	seed of the generated keys (default 1)\n");
+  printf("          --key-len K	length of the generated keys in bytes (default 16)\n");
+  printf("          -j THREADS	number of threads (default 1)\n");
+  printf("          -o FILE	output file (default stdout)\n");
+  printf("          --scalar	use the single state kernels (for comparison)\n");
+  printf("          --hex	write one line of hex digits per key instead of raw bytes\n");
+  exit(0);
+}
+
 int main(int argc, char *argv[])
 {
-  if(argc != 3)
+  static struct option long_options[] =
+  {
+    {"alpha", required_argument, 0, 'a'},
+    {"bulk", no_argument, 0, 'B'},
+    {"len", required_argument, 0, 'L'},
+    {"keys", required_argument, 0, 'K'},
+    {"seed", required_argument, 0, 'S'},
+    {"key-len", required_argument, 0, 'k'},
+    {"scalar", no_argument, 0, 'C'},
+    {"hex", no_argument, 0, 'H'},
+    {0, 0, 0, 0}
+  };
+  int alpha = DEFAULT_ALPHA;
+  int opt;
+  int is_bulk = 0, nthreads = 1;
+  char *keys_file = NULL, *out_file = NULL;
+  bulk b;
+
+  memset(&b, 0, sizeof(b));
+  b.len = -1;
+  b.nkeys = -1;
+  b.key_len = 16;
+  b.seed = 1;
+  while((opt = getopt_long(argc, argv, "n:j:o:", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 'a': alpha = atoi(optarg); break;
+      case 'B': is_bulk = 1; break;
+      case 'L': b.len = atoi(optarg); break;
+      case 'K': keys_file = optarg; break;
+      case 'S': b.seed = strtoull(optarg, NULL, 0); break;
+      case 'k': b.key_len = atoi(optarg); break;
+      case 'C': b.scalar = 1; break;
+      case 'H': b.hex = 1; break;
+      case 'n': b.nkeys = atol(optarg); break;
+      case 'j': nthreads = atoi(optarg); break;
+      case 'o': out_file = optarg; break;
+      default: usage();
+    }
+  }
+  const struct rc4_kernels *k = rc4_select(alpha);
+  if(k == NULL)
+    usage();
+  if(is_bulk)
   {
-    printf("Reduced RC4 key stream cipher (ALPHA=%d bits, state size is %d)\n\n", ALPHA, SIZE);
-    printf("Usage: rc4test KEY LEN \n");
-    printf("          KEY	encryption key (in hex)\n");
-    printf("          LEN	the lenght of the keystream to generate\n");
-    exit(0);
+    if(optind != argc || b.len < 1 || nthreads < 1 || b.key_len < 1 || b.key_len > BULK_MAX_KEY || (keys_file == NULL && b.nkeys < 0))
+      usage();
+    b.k = k;
+    b.out = stdout;
+    if(keys_file != NULL)
+    {
+      b.keys = strcmp(keys_file, "-") == 0 ? stdin : fopen(keys_file, "r");
+      if(b.keys == NULL)
+      {
+        fprintf(stderr, "Cannot open %s\n", keys_file);
+        return 1;
+      }
+    }
+    if(out_file != NULL && (b.out = fopen(out_file, "wb")) == NULL)
+    {
+      fprintf(stderr, "Cannot open %s\n", out_file);
+      return 1;
+    }
+    run_bulk(&b, nthreads);
+    if(b.out != stdout)
+      fclose(b.out);
+    return 0;
   }
+  if(argc - optind != 2)
+    usage();
+  int size = 1<<alpha;
   int i = 0;
   int j = 0;
-  uint8_t s[SIZE]; // RC4 state permutation
+  uint8_t s[MAX_SIZE]; // RC4 state permutation
 
   // Parse the key from the command line
-  uint8_t *key_str = (uint8_t *)argv[1];
-  int stream_len = atoi(argv[2]);
+  uint8_t *key_str = (uint8_t *)argv[optind];
+  int stream_len = atoi(argv[optind+1]);
   int key_len = strlen((char *)key_str)/2;
   uint8_t *key = (uint8_t*)alloca(key_len);
   fromHex(key, key_str, key_len, 0);
 
   // Init the cipher
-  rc4_init(key,key_len,s);
+  k->ksa(key,key_len,s);
+  uint8_t z[HEX_CHUNK];
   printf("Keystream: ");
   for(i=1;i<=stream_len;i++)
   {
-    uint8_t k = rc4_step(s,ind(i),&j);
-    printf("%02x",k);
+    z[(i-1)%HEX_CHUNK] = k->prga(s,i&(size-1),&j);
+    if(i%HEX_CHUNK == 0 || i == stream_len)
+      showHex(z, (i-1)%HEX_CHUNK+1, 0);
   }
   printf("\nSecret state at the last step:\n");
-  print_permutation(s);
+  print_permutation(s, size);
   return 0;
 }
@@ -0,0 +1,2517 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include "rc4prga.h"
+#include "recovery.h"
+
+#ifdef DEBUG
+# define DEBUG_PRINT(x) printf x
+#else
+//# define DEBUG_PRINT(x) do {} while (0)
+# define DEBUG_PRINT(x)
+#endif
+
+/* Conflict sets, only tracked by the instrumented build (-DCONFLICT_STATS,
+ * see bt_loop()): which guesses an entry or a contradiction rests on */
+#ifdef CONFLICT_STATS
+# define NOTE_WHY(c,d) ((c)->why = (d))
+# define NOTE_CONFLICT(c,d) ((c)->conflict = (d))
+#else
+# define NOTE_WHY(c,d)
+# define NOTE_CONFLICT(c,d)
+#endif
+#define DEP(c,x) ((c)->dep[x] | (c)->dep_j) // the value found at S[x], and that it is found there
+#define LEVEL_BIT(d) ((d) < 64 ? 1ULL << (d) : 0) // guesses of the frame at depth <d>
+#define BELOW(d) ((d) < 64 ? (1ULL << (d)) - 1 : ~0ULL) // guesses of the frames above depth <d>
+
+/* Function definitions */
+
+/* Entry of the permutation, or -1 if it is not known yet
+*/
+int get_s(candidate *c, int x)
+{
+  return KNOWN(c,x) ? c->s[x] : -1;
+}
+
+/* Entry of the inverse permutation, or -1 if it is not known yet
+*/
+int get_inv_s(candidate *c, int v)
+{
+  return USED(c,v) ? c->inv_s[v] : -1;
+}
+
+/* Print candidate_struct fields in DEBUG mode
+ *
+ * Print partially filled permutation and inverse permutation
+ * only if -DDEBUG was set during the compilation time
+ *
+ * @param c Struct to print
+ * @return void
+*/
+void debug_print_candidate(candidate *c)
+{
+  int l = 0;
+
+  DEBUG_PRINT(("Permuation:\n"));
+  for(l=0;l<SIZE;l++)
+    DEBUG_PRINT(("% 3d ", l));
+  DEBUG_PRINT(("\n"));
+  for(l=0;l<SIZE;l++)
+    DEBUG_PRINT(("% 3d ", get_s(c,l)));
+
+  DEBUG_PRINT(("\n"));
+
+  DEBUG_PRINT(("Reverse permuation:\n"));
+  for(l=0;l<SIZE;l++)
+    DEBUG_PRINT(("% 3d ", l));
+  DEBUG_PRINT(("\n"));
+  for(l=0;l<SIZE;l++)
+    DEBUG_PRINT(("% 3d ", get_inv_s(c,l)));
+
+  DEBUG_PRINT(("\n"));
+  DEBUG_PRINT(("t=%d; i=%d; j=%d\n", c->t, c->i, c->j));
+  return;
+}
+
+
+/* Check if the candidate's permutation does not have dublicates
+ *
+ * @param c Candidate to check
+ * @return 0 if it has none, -1 otherwise
+*/
+int sanity_check(candidate *c)
+{
+  //Extra array needed
+  uint8_t *s = c->s;
+  int numbers[SIZE];
+  int l;
+
+  for(l=0;l<SIZE;l++)
+    numbers[l] = 0;
+
+  for(l=0;l<SIZE;l++)
+  {
+    if(!KNOWN(c,l))
+      continue;
+    //Check if that number is already present
+    if((numbers[s[l]] == 0) )
+      numbers[s[l]]++;
+    else
+    {
+      //Duplicate found
+      DEBUG_PRINT(("sanity_check(): Dublicate found: %d (%d times)",s[l], numbers[s[l]]));
+#ifdef DEBUG
+      debug_print_candidate(c);
+#endif
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Value ordering
+ *
+ * The values of a guessed entry are tried by rank: guessed_si/guessed_sj
+ * and the step() arguments are ranks, and the r-th value is the r-th free
+ * one in the order of the search. With ORDER_ASCENDING (ord == NULL) rank r
+ * is value r, as it always was.
+ *
+ * ORDER_BIASED first tries the value the keystream points at. By Jenkins'
+ * glimpse correlation, the value guessed for S[i] at step t is i-z[t], and
+ * the one for S[j] is j-z[t], with probability 2/SIZE instead of 1/SIZE.
+ * The other values follow by their probability at that position right
+ * after the key schedule (Mantin's formula), which is exact when the search
+ * starts at the beginning of the keystream: an entry the search has not
+ * touched yet still holds its value from the key schedule. Elsewhere they
+ * follow in ascending order. The order only depends on the keystream, so
+ * the search stays complete and deterministic and checkpoints replay it.
+ *
+ * ORDER_RANDOM, used by the portfolio, tries the values of every entry in
+ * a seeded random order that stays close to the ascending one (see
+ * shuffle_values()).
+*/
+
+static uint8_t prior_order[SIZE][SIZE]; // prior_order[x]: values of S[x] after the key schedule, most likely first
+static uint8_t prior_rank[SIZE][SIZE]; // prior_rank[x][v]: position of v in prior_order[x]
+static uint8_t identity[SIZE]; // ascending order, which is its own rank table
+static pthread_once_t prior_once = PTHREAD_ONCE_INIT;
+
+/* Fill the tables above; the probability of S[x] = v after the key schedule
+ * with a random key is (Mantin)
+ *   ((1-1/N)^v + (1-(1-1/N)^v) (1-1/N)^(N-x-1)) / N   if v <= x
+ *   ((1-1/N)^(N-x-1) + (1-1/N)^v) / N                  if v > x
+*/
+static void init_prior()
+{
+  double p[SIZE], a[SIZE+1];
+  int x, v, l;
+
+  a[0] = 1;
+  for(l=1;l<=SIZE;l++)
+    a[l] = a[l-1]*(1-1.0/SIZE);
+  for(v=0;v<SIZE;v++)
+    identity[v] = v;
+  for(x=0;x<SIZE;x++)
+  {
+    for(v=0;v<SIZE;v++)
+      p[v] = v <= x ? a[v] + (1-a[v])*a[SIZE-x-1] : a[SIZE-x-1] + a[v];
+    for(v=0;v<SIZE;v++) // insertion sort, equal values stay ascending
+    {
+      for(l=v;l>0 && p[prior_order[x][l-1]] < p[v];l--)
+        prior_order[x][l] = prior_order[x][l-1];
+      prior_order[x][l] = v;
+    }
+    for(l=0;l<SIZE;l++)
+      prior_rank[x][prior_order[x][l]] = l;
+  }
+}
+
+/* Fill ord->values with a random order of the values of every entry:
+ * value v is ranked by v + u with u uniform in [0, SIZE/4). A uniform
+ * shuffle needs 2-4 times the nodes of the ascending order on average, a
+ * jitter of a quarter of the values moves the solution about as much and
+ * costs nothing on average.
+ *
+ * @param ord Ordering with room for SIZE*SIZE values
+ * @param seed Seed of the order (xorshift64, must not be 0)
+ * @return void
+*/
+static void shuffle_values(ordering *ord, uint64_t seed)
+{
+  uint32_t key[SIZE];
+  int x, v, l;
+  for(x=0;x<SIZE;x++)
+  {
+    uint8_t *order = &ord->values[x*SIZE];
+    for(v=0;v<SIZE;v++)
+    {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      key[v] = (v << 16) + seed % ((SIZE/4) << 16);
+      for(l=v;l>0 && key[order[l-1]] > key[v];l--) // insertion sort, values move by less than SIZE/4
+        order[l] = order[l-1];
+      order[l] = v;
+    }
+  }
+}
+
+/* Value of rank <r> for S[x]: <g> first, then the others in the base order */
+static inline int ranked_value(candidate *c, const ordering *ord, int x, int g, int r)
+{
+  if(ord->policy == ORDER_RANDOM)
+    return ord->values[x*SIZE+r];
+  const uint8_t *order = c->start < 0 ? prior_order[x] : identity;
+  const uint8_t *rank = c->start < 0 ? prior_rank[x] : identity;
+  if(r == 0)
+    return g;
+  r--;
+  if(r >= rank[g])
+    r++;
+  return order[r];
+}
+
+/* Guess S[x]: the first free value of rank <start> or more
+ *
+ * @param c Candidate
+ * @param ord Value ordering, NULL for ascending values
+ * @param x Entry to guess
+ * @param g Value the keystream points at (ORDER_BIASED)
+ * @param start Smallest rank to try
+ * @param value The value goes here
+ * @return Its rank, -1 if no free value is left
+*/
+static inline int guess_ranked(candidate *c, const ordering *ord, int x, int g, int start, int *value)
+{
+  int r;
+  if(ord == NULL)
+    return *value = guess_entry(c, start);
+  for(r=start;r<SIZE;r++)
+  {
+    *value = ranked_value(c, ord, x, g, r);
+    if(!USED(c,*value))
+      return r;
+  }
+  return *value = -1;
+}
+
+#ifdef CONFLICT_STATS
+/* Guesses behind all known entries (and j): what rules out the used values */
+static uint64_t placed(candidate *c)
+{
+  uint64_t d = c->dep_j;
+  int x;
+  for(x=0;x<SIZE;x++)
+    if(KNOWN(c,x))
+      d |= c->dep[x];
+  return d;
+}
+#endif
+
+/* Try to make a RC4 step for the candidate (i.e. update the permutation)
+ *
+ * If the necessary entries in the permutation are not
+ * defined, guess them. First guess S[i] (if neceseary) and
+ * then guess S[j] (if necessary). The candidate is modified in place,
+ * changes of the permutation go to the trail (also on failure).
+ *
+ * @param c Candidate for which to make an RC4 step
+ * @param tr Trail of the candidate
+ * @param si_start The guessed value for S[i] should be larger than <si_start>
+ * @param sj_start The guessed value for S[j] should be larger than <sj_start>
+ * @return  0 Successfully guessed both values (everything is alright)
+ *         -1 Could not guess value for S[i] (for the curren value of <si_start>)
+ *         -2 Could not guess value for S[j] (for the curren value of <sj_start>)
+ *            and S[i] can be re-guessed
+ *         -3 Could not guess value for S[j] (for the curren value of <sj_start>)
+ *            and S[i] cannot be re-guessed (it was already set in previous steps)
+ *         -4 Neither S[i] nor S[j] were guessed (they already were set in the permutation
+ *            in the previous steps) (everything is alright)
+ *	   -5 S[i] was guessed successfully, but S[j] could not be guessed
+*/
+static inline int make_step(candidate *c, trail *tr, int si_start, int sj_start, const ordering *ord)
+{
+ 
+  int is_si_guessed = 0;
+  int is_sj_guessed = 0;
+   
+  DEBUG_PRINT(("step(): starting step\n"));
+  
+  DEBUG_PRINT(("Updating i: %d -> ",c->i));
+  c->i = ind(c->i+1); 
+  DEBUG_PRINT(("%d\n",c->i));
+
+  if (c->j == -1) // If we lost track of <j> (a bug: every root knows j)
+  {
+    DEBUG_PRINT(("Bug: we lost track of j\n"));
+    return -1;
+  }
+
+  // keystream byte of this step, which steers the guesses with ORDER_BIASED
+  int zt = ord != NULL ? ord->z[c->t+1] : 0;
+  NOTE_WHY(c, LEVEL_BIT(c->t - c->start));
+
+  // Guess s[i] if needed
+  if (!KNOWN(c,c->i))
+  {
+    int entry;
+    int rank = guess_ranked(c, ord, c->i, ind(c->i-zt), si_start, &entry);
+    if (rank == -1)
+    {
+      DEBUG_PRINT(("WARNING: cannot guees a value for S[i]\n"));
+      return -1;
+    }
+    assign(c, tr, c->i, entry);
+    c->guessed_si = rank;
+    is_si_guessed = 1;
+    DEBUG_PRINT(("step(): Guessing S[%d] = %d\n", c->i,c->s[c->i]));
+  } else
+  {
+    DEBUG_PRINT(("step(): No guessing: S[%d]=%d is known\n", c->i,c->s[c->i]));
+  }
+
+  DEBUG_PRINT(("Updating j: %d -> ",c->j));
+  c->j = ind(c->j+c->s[c->i]);
+#ifdef CONFLICT_STATS
+  c->dep_j |= c->dep[c->i];
+#endif
+  DEBUG_PRINT(("%d\n",c->j));
+
+  // Guess s[j] if needed
+  if (!KNOWN(c,c->j))
+  {
+    int entry;
+    int rank = guess_ranked(c, ord, c->j, ind(c->j-zt), sj_start, &entry);
+    c->guessed_sj = rank;
+    is_sj_guessed = 1;
+    if (rank == -1 && (is_si_guessed == 1 ))
+    {
+      DEBUG_PRINT(("step(): WARNING: cannot guees a value for S[j] (will try to increase s[i])\n"));
+      return -2;
+    }
+    if (rank == -1 && (is_si_guessed == 0 ))
+    {
+      DEBUG_PRINT(("step(): WARNING: cannot guees a value for S[j] (an s[i] is fixed)\n"));
+      return -3;
+    }
+    assign(c, tr, c->j, entry);
+    DEBUG_PRINT(("step(): Guessing S[%d] = %d\n", c->j,c->s[c->j]));
+  } else
+  {
+    DEBUG_PRINT(("step(): No guessing: S[%d]=%d is known\n", c->j,c->s[c->j]));
+  }
+
+  DEBUG_PRINT(("step(): swapping positions s[%d]=%d and s[%d]=%d\n", c->i,c->s[c->i],c->j,c->s[c->j]));
+  swap(c, tr, c->i, c->j);
+
+  DEBUG_PRINT(("step(): step completed\n"));
+  if( (is_si_guessed == 0) && (is_sj_guessed == 0) ) // if no guessing was made
+  {
+    DEBUG_PRINT(("step(): No guessing at all\n"));
+    return -4;
+  }
+
+  if( (is_si_guessed == 1) && (is_sj_guessed == 0) ) // if s[i] was guessed but s[j] was not
+  {
+    DEBUG_PRINT(("step(): S[i] was guessed but s[j] was not\n"));
+    return -5;
+  }
+  return 0;
+}
+
+/* Out of line make_step(), for the benchmarks; derive() has it inlined
+*/
+int step(candidate *c, trail *tr, int si_start, int sj_start)
+{
+  return make_step(c, tr, si_start, sj_start, NULL);
+}
+
+
+/* Hash of a path in the search tree, extended by one step
+ *
+ * A child is identified among its siblings by the values its step swapped
+ * into S[i] and S[j], so hashing these from the root identifies a candidate
+ * in the tree no matter in which order (or by which thread or process)
+ * the tree is explored. (The step() arguments would not do: the ones for
+ * an S[i] that is already known are left over from other subtrees.)
+*/
+static inline uint64_t path_mix(uint64_t h, int a, int b)
+{
+  h ^= ((uint64_t)(a+1) << 32) ^ (uint64_t)(b+1);
+  h *= 0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 29);
+}
+
+/* Derive a child of the parent remembered in frame <f>
+ *
+ * Invokes RC4 step on <c> (the parent) in place and returns with a code
+ * which describes if the guesses during the step went OK. The arguments
+ * of the step are kept in <f>, so that the child can be derived again
+ * from its parent (see replay()).
+ *
+ * @param c Parent candidate; becomes the child
+ * @param f Frame of the parent (updated with the new guesses)
+ * @param tr Trail of the candidate
+ * @param si_start Passed to step()
+ * @param sj_start Passed to step()
+ * @param is_first Set if this is the first child of the parent
+ * @return 0 The child is ready for update_state()
+ *         1 There are no (more) children
+ *         2 Skip this child, but try the next one
+*/
+static int derive(candidate *c, frame *f, trail *tr, int si_start, int sj_start, int is_first, const ordering *ord)
+{
+  int ret = 1;
+  f->si_start = si_start;
+  f->sj_start = sj_start;
+  f->is_first = is_first;
+
+  // Returns 0 if everything is good
+  int res = make_step(c, tr, si_start, sj_start, ord); // Make a step and guess permutation entries if necessary
+
+  if(res == -1) // cannot guess s[i], end
+    ret = 1; // stop candidates cycle
+
+  if(res == -4 && !is_first) // no guessing is happenning at all (and corresponding s[i] and s[j] value were already considered in the first() function), end
+    ret = 1;
+
+  if(res == -3) // cannot guess s[j], and cannot re-guess s[i] (it is fixed), end
+    ret = 1; // stop candidates cycle
+
+
+  if(res == -2) // cannot guess s[j], but can re-guess s[i]
+                // In this case we did not really assign any new values, so we should no go
+		// deeper into recursion for this case; at the same time we
+		// should not interrupt the current level of recursion
+  {
+    c->guessed_si++;// = 1;
+    c->guessed_sj = -1;
+    ret = 2; // skip current candidate in the candidate cycle, and to next
+  }
+
+  if(res == -5) // guessed s[i], but s[j] was determinstic, so let's increase the counters for the next time
+                // This case is valid in the sence that we should launch update_state
+		// and go deeper into recursion
+  {
+    c->guessed_si++;// = 1;
+    c->guessed_sj = -1;
+  }
+
+  // -4 means that S[i] and S[j] were fixed, so we did not do any guesses
+  if( (res == 0) || (res == -5) || (res == -4 && is_first) )
+  {
+    ret = 0;
+    c->path = path_mix(f->path, c->s[c->i], c->s[c->j]);
+  }
+#ifdef CONFLICT_STATS
+  if(res == -1 || res == -2 || res == -3) // the used values rule out every value left for S[i] or S[j]
+    f->conflict |= placed(c) & BELOW(c->t - c->start);
+#endif
+  f->guessed_si = c->guessed_si;
+  f->guessed_sj = c->guessed_sj;
+  return ret;
+}
+
+/* Get the first child of a candidate for backtracking
+ * 
+ * Remembers candidate <c> in frame <f> (so that next() can return to it)
+ * and derives its first child in place
+ *
+ * @param c Candidate from which to derive the one for recursion; becomes the child
+ * @param f Frame to remember the parent and the guessed values in
+ * @param tr Trail of the candidate
+ * @return 0 The child is ready for update_state()
+ *         1 There are no children
+ *         2 Skip this child, but try the next one
+*/
+int first(candidate *c, frame *f, trail *tr, const ordering *ord)
+{
+  f->i = c->i;
+  f->j = c->j;
+  f->t = c->t;
+  f->mark = tr->top;
+  f->path = c->path;
+#ifdef CONFLICT_STATS
+  f->dep_j = c->dep_j;
+  f->conflict = 0;
+#endif
+  return derive(c, f, tr, 0, 0, 1, ord);
+}
+
+/* Get the next child of a candidate for backtracking
+ * 
+ * Rolls the candidate back to the parent remembered in frame <f>
+ * and derives the child after the last one in place
+ *
+ * @param c Candidate to derive the child in
+ * @param f Frame of the parent (updated with the new guesses)
+ * @param tr Trail of the candidate
+ * @return 0 The child is ready for update_state()
+ *         1 There are no more children
+ *         2 Skip this child, but try the next one
+*/
+int next(candidate *c, frame *f, trail *tr, const ordering *ord)
+{
+  rollback(c, tr, f->mark);
+  c->i = f->i;
+  c->j = f->j;
+  c->t = f->t;
+  c->path = f->path;
+#ifdef CONFLICT_STATS
+  c->dep_j = f->dep_j;
+#endif
+  return derive(c, f, tr, f->guessed_si, f->guessed_sj+1, 0, ord);
+}
+
+
+/* Return empty candidate at the root of the search tree for backtracking.
+ *
+ * No entries of the permutation are known, all values are unused
+ * i and j are set to 0
+ * t (current step) is set to -1
+ *
+ * The search always starts here, at keystream offset 0, not at the most
+ * constraining window of the keystream. Anywhere else j is unknown and
+ * has to be guessed, which multiplies the tree by SIZE: on 12 random 5
+ * byte keys (ALPHA=4, 40 bytes) the windows with the most repeated
+ * values took 599M nodes to the first state against 20.9M from offset
+ * 0, and still 31.7M with the right j given.
+*/
+candidate root()
+{
+  candidate c;
+  int l = 0;
+  for(l = 0; l < WORDS; l++)
+  {
+    c.known[l] = 0;
+    c.unused[l] = (SIZE - 64*l >= 64) ? ~0ULL : (1ULL << (SIZE - 64*l)) - 1;
+  }
+  c.i = 0;
+  c.j = 0;
+  c.t = -1;
+  c.start = -1;
+  c.path = 0;
+  c.guessed_si = 0;
+  c.guessed_sj = 0;
+#ifdef CONFLICT_STATS
+  c.dep_j = 0;
+  c.why = 0;
+  c.conflict = 0;
+#endif
+  return c;
+}
+
+/* Update the permutation and inverse permutation based on the
+ * keystream. Return -1 if there is a contradiction:
+ * Each new value we add to the permutation <s> should be either different from
+ * the existing elements or should have the same index.
+ *
+ * @param c Candidate to update
+ * @param tr Trail of the candidate
+ * @param z Keystream
+ * @return  0 No contradictions
+ *         <0 There was a contradiction with the current state, the value
+ *            is the negated prune_reason (the rule that found it)
+*/
+int update_state(candidate *c, trail *tr, uint8_t *z)
+{
+    int i = c->i;
+    int j = c->j;
+    int t = c->t;
+    uint8_t *s = c->s;
+    uint8_t *inv_s = c->inv_s;
+
+    if (t < 0) // the root candidate has not consumed any keystream yet
+      return 0;
+
+    int zt = (int)z[t];
+
+    DEBUG_PRINT(("update_state(): zt=%d\n",zt));
+    DEBUG_PRINT(("update_state(): inv_s[zt]=%d\n",get_inv_s(c,zt)));
+    DEBUG_PRINT(("update_state(): j=%d\n",j));
+    if (j != -1)
+    {
+      DEBUG_PRINT(("update_state(): s[j=%d] is %s\n",j, KNOWN(c,j) ? "known" : "not known"));
+    }
+    DEBUG_PRINT(("update_state(): s[i=%d] is %s\n",i, KNOWN(c,i) ? "known" : "not known"));
+
+    // If S[i_t], S[j_t], and j_t are known, add Z[t] to the permutation
+    if( KNOWN(c,i) && (j != -1 ) && KNOWN(c,j) )
+    {
+      int idx = ind(s[i]+s[j]);
+
+      if ( KNOWN(c,idx) && (s[idx] != zt) )
+      {
+        DEBUG_PRINT(("Was trying to update s[s[i]+s[j]=%d] with zt=%d (already occupied with %d)\n", idx, zt, s[idx]));
+        NOTE_CONFLICT(c, DEP(c,i) | DEP(c,j) | DEP(c,idx));
+        return -PRUNE_OCCUPIED;
+      }
+
+      if ( USED(c,zt) && (inv_s[zt] != idx) )
+      {
+        DEBUG_PRINT(("Was trying to update s[s[i]+s[j]=%d] with zt=%d (zt already appear at index %d)\n", idx, zt, inv_s[zt]));
+        NOTE_CONFLICT(c, DEP(c,i) | DEP(c,j) | DEP(c,inv_s[zt]));
+        return -PRUNE_DUPLICATE;
+      }
+      DEBUG_PRINT(("Updating s[s[i]+s[j]=%d] with zt=%d\n", idx, zt));
+      NOTE_WHY(c, DEP(c,i) | DEP(c,j));
+      if (!KNOWN(c,idx))
+        assign(c, tr, idx, zt);
+    }
+
+    // If S⁻¹[zₜ], jₜ, and S[iₜ] are known, determine S[jₜ]
+    if( USED(c,zt) && (j != -1 ) && KNOWN(c,i) )
+    {
+      int entry = ind(inv_s[zt]-s[i]); 
+      if( KNOWN(c,j) && (s[j] != entry) )  // if the entry already appears in the permutation with a different index
+      {
+        DEBUG_PRINT(("Entry %d already appears in the permutation with index different from j\n", entry));
+        NOTE_CONFLICT(c, DEP(c,inv_s[zt]) | DEP(c,i) | DEP(c,j));
+        return -PRUNE_SJ;
+      }
+      if( !KNOWN(c,j) && USED(c,entry) ) // the entry is already used elsewhere
+      {
+        DEBUG_PRINT(("Entry %d already appears in the permutation at index %d\n", entry, inv_s[entry]));
+        NOTE_CONFLICT(c, DEP(c,inv_s[zt]) | DEP(c,i) | DEP(c,inv_s[entry]));
+        return -PRUNE_SJ;
+      }
+      DEBUG_PRINT(("Updating s[j=%d] with inv_s[zt]-s[i]=%d\n", j, entry));
+      NOTE_WHY(c, DEP(c,inv_s[zt]) | DEP(c,i));
+      if (!KNOWN(c,j))
+        assign(c, tr, j, entry);
+    }
+
+    // If S⁻¹[Z_t], j_t, and S[j_t] are known, determine S[i_t]
+    if( USED(c,zt) && (j != -1 ) && KNOWN(c,j) )
+    {
+      int entry = ind(inv_s[zt]-s[j]); 
+      if( KNOWN(c,i) && (s[i] != entry) ) // if the entry already appears in the permutation with a different index
+      {
+        DEBUG_PRINT(("Entry %d appears in the permutation with index different from i\n", entry));
+        NOTE_CONFLICT(c, DEP(c,inv_s[zt]) | DEP(c,j) | DEP(c,i));
+        return -PRUNE_SI;
+      }
+      if( !KNOWN(c,i) && USED(c,entry) ) // the entry is already used elsewhere
+      {
+        DEBUG_PRINT(("Entry %d already appears in the permutation at index %d\n", entry, inv_s[entry]));
+        NOTE_CONFLICT(c, DEP(c,inv_s[zt]) | DEP(c,j) | DEP(c,inv_s[entry]));
+        return -PRUNE_SI;
+      }
+      DEBUG_PRINT(("Updating s[i=%d] with inv_s[zt]-s[j]=%d\n", i, entry));
+      NOTE_WHY(c, DEP(c,inv_s[zt]) | DEP(c,j));
+      if (!KNOWN(c,i))
+        assign(c, tr, i, entry);
+    }
+
+    if( KNOWN(c,i) && USED(c,zt) && USED(c,ind(inv_s[zt]-s[i])) )
+    {
+      j = inv_s[ind(inv_s[zt]-s[i])];
+      if(c->j != j) // the computed value of <j> does not coincide with the one set before => contradicition
+      {
+        DEBUG_PRINT(("the computed value of <j> does not coincide with the one set before\n"));
+        NOTE_CONFLICT(c, DEP(c,inv_s[zt]) | DEP(c,i) | DEP(c,j));
+        return -PRUNE_J;
+      }
+    }
+
+    return 0; // no contradiction
+}
+
+
+/* Check if a step can produce keystream byte <zt>
+ *
+ * The step swaps S[i]=<a> and S[jj]=<b>; <a> and/or <b> can be guesses that
+ * are not in the candidate yet. The output S[a+b] is checked against <zt>
+ * the way update_state() would do it.
+*/
+static int output_possible(candidate *c, int zt, int i, int jj, int a, int b)
+{
+  int idx = ind(a+b);
+  if(idx == i)
+    return b == zt;
+  if(idx == jj)
+    return a == zt;
+  if(KNOWN(c,idx))
+    return c->s[idx] == zt;
+  return !USED(c,zt) && (zt != a) && (zt != b);
+}
+
+/* Check if some guess for the next step can produce keystream byte <zt>
+ *
+ * The candidate's i is already advanced to the step. If S[i] is known
+ * (and so is j), every unused value for S[j] is tried. Otherwise every
+ * unused value for S[i] is tried; if the corresponding S[j] is unknown
+ * too, the step is assumed to be possible.
+ *
+ * @param c Candidate right before the guesses of the step
+ * @param zt Keystream byte the step has to produce
+ * @return 1 if at least one guess may be consistent with <zt>, 0 otherwise
+*/
+static int step_possible(candidate *c, int zt)
+{
+  int i = c->i;
+  int v;
+
+  if(KNOWN(c,i))
+  {
+    for(v = guess_entry(c, 0); v != -1; v = guess_entry(c, v+1))
+      if(output_possible(c, zt, i, c->j, c->s[i], v))
+        return 1;
+    return 0;
+  }
+
+  for(v = guess_entry(c, 0); v != -1; v = guess_entry(c, v+1))
+  {
+    int jj = ind(c->j+v);
+    if(jj == i)
+    {
+      if(output_possible(c, zt, i, i, v, v))
+        return 1;
+    }
+    else if(!KNOWN(c,jj) || output_possible(c, zt, i, jj, v, c->s[jj]))
+      return 1;
+  }
+  return 0;
+}
+
+/* Forward checking over the next keystream bytes
+ *
+ * Simulates up to <k> steps after the candidate's position as long as
+ * they need no guessing (S[i] and S[j] known) and applies update_state()
+ * to each of them. The first step that needs a guess is checked with
+ * step_possible() and ends the lookahead. The candidate is rolled back
+ * afterwards.
+ *
+ * @param c Candidate that passed update_state()
+ * @param tr Trail of the candidate
+ * @param z Keystream
+ * @param z_len Lenght of the keystream
+ * @param k Number of keystream bytes to look ahead
+ * @return  0 No contradictions
+ *         -1 One of the next <k> keystream bytes cannot be produced
+*/
+int forward_check(candidate *c, trail *tr, uint8_t *z, int z_len, int k)
+{
+  int i = c->i;
+  int j = c->j;
+  int t = c->t;
+  int mark = tr->top;
+  int ret = 0;
+  int u;
+
+  for(u = t+1; (u <= t+k) && (u < z_len); u++)
+  {
+    c->i = ind(c->i+1);
+    if(KNOWN(c,c->i))
+      c->j = ind(c->j+c->s[c->i]);
+    if(!KNOWN(c,c->i) || !KNOWN(c,c->j))
+    {
+      if(!step_possible(c, z[u]))
+      {
+        DEBUG_PRINT(("forward_check(): no guess produces z[%d]=%d\n", u, z[u]));
+        ret = -1;
+      }
+      break;
+    }
+    swap(c, tr, c->i, c->j);
+    c->t = u;
+    if(update_state(c, tr, z) < 0)
+    {
+      DEBUG_PRINT(("forward_check(): contradiction at t=%d\n", u));
+      ret = -1;
+      break;
+    }
+  }
+
+  rollback(c, tr, mark);
+  c->i = i;
+  c->j = j;
+  c->t = t;
+  return ret;
+}
+
+/* Sharding
+ *
+ * The tree is split between shards at the candidates <shard_depth>
+ * keystream bytes below their root (the prefixes): a prefix goes to shard
+ * (hash of its path) mod <nshards>, so every process computes the same
+ * split by itself. A shard skips the other shards' prefixes, solutions
+ * above the split belong to shard 0.
+*/
+
+/* Number of steps from the root to a candidate */
+static inline int tree_level(candidate *c)
+{
+  return c->t - c->start;
+}
+
+/* Does a prefix (or a solution above the split) belong to our shard?
+ * Candidates below the split always do, their prefix was checked already.
+*/
+static int in_shard(candidate *c, struct recovery_params *p)
+{
+  if(tree_level(c) != p->shard_depth)
+    return 1;
+  uint64_t h = c->path;
+  h = (h ^ (h >> 31)) * 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  return (int)(h % p->nshards) == p->shard;
+}
+
+/* Wait until <need> bytes of the keystream have arrived or the input ended
+ *
+ * @return Bytes that have arrived
+*/
+static int feed_wait(struct keystream_feed *f, int need)
+{
+  pthread_mutex_lock(&f->lock);
+  while(f->avail < need && !f->done)
+    pthread_cond_wait(&f->more, &f->lock);
+  int avail = f->avail;
+  pthread_mutex_unlock(&f->lock);
+  return avail;
+}
+
+/* Length of the keystream a candidate at position <need>-1 can go on with
+ *
+ * Without a feed this is p->z_len. With one, waits until byte <need>-1 has
+ * arrived or the input has ended, so a value below <need> means that the
+ * keystream ends there. The bytes seen so far are cached in the workspace
+ * and the feed is only locked when the search gets past them.
+*/
+static int keystream_len(search *sr, workspace *ws, int need)
+{
+  if(sr->p->feed == NULL)
+    return sr->z_len;
+  if(need <= ws->avail)
+    return ws->avail;
+  ws->avail = feed_wait(sr->p->feed, need);
+  return ws->avail;
+}
+
+/* Is the candidate at the last byte of the keystream? (waits for the next
+ * byte if the keystream is still arriving) */
+static inline int at_end(candidate *c, workspace *ws, search *sr)
+{
+  return c->t >= keystream_len(sr, ws, c->t+2)-1;
+}
+
+/* Check a new candidate against the keystream
+ *
+ * update_state() followed by the lookahead over the next bytes (if enabled),
+ * counted in the statistics of the calling thread
+ *
+ * @return 0 No contradictions, -1 the candidate is dead
+*/
+static int check_candidate(candidate *c, workspace *ws, search *sr)
+{
+  struct recovery_stats *st = &ws->stats;
+  if(sr->p->nshards > 1 && !in_shard(c, sr->p))
+  {
+    NOTE_CONFLICT(c, ~0ULL);
+    return -1;
+  }
+  int ret = update_state(c, &ws->tr, sr->z);
+  int len = sr->p->feed != NULL ? ws->avail : sr->z_len; // the lookahead does not wait for bytes
+  if(ret == 0 && sr->p->lookahead > 0 && forward_check(c, &ws->tr, sr->z, len, sr->p->lookahead) < 0)
+  {
+    NOTE_CONFLICT(c, placed(c));
+    ret = -PRUNE_LOOKAHEAD;
+  }
+  st->nodes[c->t+1]++;
+  if(ret < 0)
+  {
+    st->dead[c->t+1]++;
+    st->pruned[-ret]++;
+    return -1;
+  }
+  return 0;
+}
+
+/* Forward simulation
+ *
+ * Once every entry of the permutation is known (or all but one, which can
+ * then only hold the last unused value) nothing is left to guess: the rest
+ * of the keystream follows from the state. Instead of a first()/
+ * update_state() level per byte, a copy of the state is run with rc4_step()
+ * until the first byte that differs from the keystream.
+*/
+
+/* Number of entries of the permutation which are not known yet */
+static inline int unknown_entries(candidate *c)
+{
+  int n = 0, l;
+  for(l=0;l<WORDS;l++)
+    n += __builtin_popcountll(~c->known[l]);
+  return n - (WORDS*64 - SIZE); // bits above SIZE are never set
+}
+
+/* Check a (nearly) determined candidate against the rest of the keystream
+ *
+ * @param c Candidate that passed check_candidate()
+ * @param ws Workspace of the calling thread
+ * @param sr Search (keystream and options)
+ * @param len Keystream bytes to check, all that have arrived so far
+ * @return  0 The candidate is not determined, search it as usual
+ *         -1 The state does not reproduce the rest of the keystream
+ *          1 It does; <c> is moved to byte <len>-1, with the swaps on the
+ *            trail so that next() undoes them
+*/
+static int simulate(candidate *c, workspace *ws, search *sr, int len)
+{
+  uint8_t s[SIZE];
+  int unknown = unknown_entries(c);
+  int hole = -1, value = -1;
+  int i, j, t;
+
+  if(unknown > 1)
+    return 0;
+  if(sr->p->nshards > 1 && tree_level(c) < sr->p->shard_depth)
+    return 0; // the split between shards has to see the path
+  memcpy(s, c->s, SIZE);
+  if(unknown == 1)
+  {
+    for(hole=0;KNOWN(c,hole);hole++)
+      ;
+    value = guess_entry(c, 0);
+    s[hole] = value;
+  }
+
+  i = c->i;
+  j = c->j;
+  for(t=c->t+1;t<len;t++)
+  {
+    i = ind(i+1);
+    if(rc4_step(s, i, &j) != sr->z[t])
+      return -1;
+  }
+
+  // In exhaustive mode a state whose last entry the search leaves unknown is
+  // reported with -1 there, so let the search find it and stay consistent
+  if(unknown == 1 && sr->p->all)
+    return 0;
+  if(unknown == 1)
+    assign(c, &ws->tr, hole, value);
+  for(t=c->t+1;t<len;t++)
+  {
+    c->i = ind(c->i+1);
+    c->j = ind(c->j+c->s[c->i]);
+    swap(c, &ws->tr, c->i, c->j);
+  }
+  c->t = len-1;
+  return 1;
+}
+
+/* Report the statistics so far if somebody asked for it with p->progress
+ *
+ * The counters of the running threads are read without locking, so the
+ * report is approximate, but it costs the search nothing.
+*/
+static void poll_progress(search *sr)
+{
+  struct recovery_params *p = sr->p;
+  int l;
+
+  pthread_mutex_lock(&sr->lock);
+  if(*p->progress)
+  {
+    *p->progress = 0;
+    struct recovery_stats st;
+    recovery_stats_init(&st, sr->z_len);
+    recovery_stats_add(&st, &sr->total);
+    for(l=0;l<sr->nlive;l++)
+      recovery_stats_add(&st, sr->live[l]);
+    if(p->on_progress != NULL)
+      p->on_progress(&st, p->progress_arg);
+    recovery_stats_free(&st);
+  }
+  pthread_mutex_unlock(&sr->lock);
+}
+
+/* Copy a candidate to the word size independent result
+*/
+static void export_candidate(candidate *c, struct recovery_result *res)
+{
+  int l;
+  res->size = SIZE;
+  for(l=0;l<SIZE;l++)
+  {
+    res->s[l] = get_s(c,l);
+    res->inv_s[l] = get_inv_s(c,l);
+  }
+  res->i = c->i;
+  res->j = c->j;
+  res->t = c->t;
+}
+
+/* FNV-1a hash of a solution key
+*/
+static uint64_t solution_hash(solution_key *k)
+{
+  uint64_t h = 14695981039346656037ULL;
+  uint8_t *p = (uint8_t *)k;
+  size_t l;
+  for(l=0;l<sizeof(solution_key);l++)
+    h = (h ^ p[l]) * 1099511628211ULL;
+  return h;
+}
+
+/* Add a final state to the set of solutions
+ *
+ * @param set Set to add to
+ * @param k Final state
+ * @return 1 if the state is new, 0 if it was already in the set,
+ *         -1 if there is no memory for it
+*/
+static int solution_set_insert(solution_set *set, solution_key *k)
+{
+  long l;
+
+  if(2*(set->count+1) > set->cap) // keep the load below one half
+  {
+    solution_set old = *set;
+    set->cap = old.cap ? 2*old.cap : 64;
+    set->count = 0;
+    set->keys = (solution_key *)malloc(set->cap*sizeof(solution_key));
+    set->used = (uint8_t *)calloc(set->cap, 1);
+    if(set->keys == NULL || set->used == NULL)
+    {
+      free(set->keys);
+      free(set->used);
+      *set = old;
+      return -1;
+    }
+    for(l=0;l<old.cap;l++)
+    {
+      if(!old.used[l])
+        continue;
+      long h = solution_hash(&old.keys[l]) & (set->cap-1);
+      while(set->used[h])
+        h = (h+1) & (set->cap-1);
+      set->keys[h] = old.keys[l];
+      set->used[h] = 1;
+      set->count++;
+    }
+    free(old.keys);
+    free(old.used);
+  }
+
+  long h = solution_hash(k) & (set->cap-1);
+  while(set->used[h])
+  {
+    if(memcmp(&set->keys[h], k, sizeof(*k)) == 0)
+      return 0;
+    h = (h+1) & (set->cap-1);
+  }
+  set->keys[h] = *k;
+  set->used[h] = 1;
+  set->count++;
+  return 1;
+}
+
+/* Add the final state of a candidate to the set of solutions
+ *
+ * @param set Set to add to
+ * @param c Candidate that survived the whole keystream
+ * @return 1 if the state is new, 0 if it was already in the set,
+ *         -1 if there is no memory for it
+*/
+static int solution_set_add(solution_set *set, candidate *c)
+{
+  solution_key k;
+  int l;
+
+  memset(&k, 0, sizeof(k));
+  for(l=0;l<SIZE;l++)
+    if(KNOWN(c,l))
+      k.s[l] = c->s[l];
+  memcpy(k.known, c->known, sizeof(k.known));
+  k.j = c->j;
+  return solution_set_insert(set, &k);
+}
+
+/* Stop the search without a solution, unless it has stopped already;
+ * the caller holds sr->lock
+ *
+ * @param sr Search
+ * @param status Why (enum recovery_status); RECOVERY_DONE if nothing is left to search
+ * @param error Description of an error status, NULL otherwise
+ * @return void
+*/
+static void halt_locked(search *sr, int status, const char *error)
+{
+  if(atomic_load(&sr->stop))
+    return; // somebody was first
+  sr->halted = 1;
+  sr->status = status;
+  sr->error = error;
+  atomic_store(&sr->stop, 1);
+}
+
+/* halt_locked() without holding the lock
+*/
+static void halt(search *sr, int status, const char *error)
+{
+  pthread_mutex_lock(&sr->lock);
+  halt_locked(sr, status, error);
+  pthread_mutex_unlock(&sr->lock);
+}
+
+/* Record a successful candidate
+ *
+ * In the default mode only the first call stores its candidate and
+ * tells everybody to stop, later ones (from other workers) are ignored.
+ * In exhaustive mode every distinct final state is passed to the
+ * solution callback and the search goes on.
+ *
+ * @param sr Search the candidate belongs to
+ * @param c Candidate that survived the whole keystream
+ * @param member Portfolio member that found it (0 without a portfolio)
+ * @return 1 if the search should stop, 0 to continue with the siblings
+*/
+static int report_solution(search *sr, candidate *c, int member)
+{
+  int stop = 1;
+  if(sr->p->nshards > 1 && sr->p->shard != 0 && tree_level(c) < sr->p->shard_depth)
+    return 0; // above the split, shard 0 reports it
+  pthread_mutex_lock(&sr->lock);
+  if(sr->p->all)
+  {
+    stop = 0;
+    int added = solution_set_add(&sr->found, c);
+    if(added < 0)
+    {
+      halt_locked(sr, RECOVERY_ERROR, "out of memory");
+      stop = 1;
+    }
+    else if(added && sr->p->on_solution != NULL)
+    {
+      struct recovery_result res;
+      export_candidate(c, &res);
+      if(sr->p->on_solution(&res, sr->p->arg))
+      {
+        atomic_store(&sr->stop, 1);
+        stop = 1;
+      }
+    }
+  }
+  else if(!atomic_load(&sr->stop))
+  {
+    sr->solution = *c;
+    sr->winner = member;
+    atomic_store(&sr->stop, 1);
+  }
+  pthread_mutex_unlock(&sr->lock);
+  return stop;
+}
+
+/* Checkpoints
+ *
+ * The sequential search is fully described by the root it started from
+ * and, for every level of the current path, the arguments of the step()
+ * which derived the child being explored: replaying these steps from the
+ * root rebuilds the candidate and the frames, and next() carries on from
+ * there. Together with the solutions found so far (exhaustive mode) this
+ * is saved as a small text file:
+ *
+ *   rc4-state-recovery-checkpoint 4
+ *   alpha 4
+ *   keystream <length> <FNV-1a digest>
+ *   options <all> <shard> <nshards> <shard depth> <value order>
+ *   hints <FNV-1a digest>                      (0 without hints)
+ *   root <index of the root>
+ *   depth <levels>
+ *   path <si_start> <sj_start> <is_first>      (one line per level)
+ *   solutions <count>
+ *   solution <j> <S[0]> ... <S[SIZE-1]>        (unknown entries are -1)
+*/
+
+#define CHECKPOINT_MAGIC "rc4-state-recovery-checkpoint"
+#define CHECKPOINT_VERSION (4)
+
+static uint64_t keystream_digest(uint8_t *z, int z_len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int l;
+  for(l=0;l<z_len;l++)
+    h = (h ^ z[l]) * 1099511628211ULL;
+  return h;
+}
+
+static uint64_t hints_digest(struct recovery_hints *hints)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int l;
+  if(hints == NULL)
+    return 0;
+  h = (h ^ (hints->t+1)) * 1099511628211ULL;
+  h = (h ^ (hints->j+1)) * 1099511628211ULL;
+  for(l=0;l<hints->n;l++)
+    h = (h ^ ((hints->x[l] << 8) | hints->v[l])) * 1099511628211ULL;
+  return h;
+}
+
+/* Save the position of the sequential search
+ *
+ * The file is written next to the checkpoint and renamed over it,
+ * so a crash while saving leaves the previous checkpoint intact.
+ *
+ * @param sr Search
+ * @param ws Workspace of the search, its frames are the current path
+ * @param depth Number of frames in use
+ * @return 0 on success, -1 if the file could not be written
+*/
+static int save_checkpoint(search *sr, workspace *ws, int depth)
+{
+  struct recovery_params *p = sr->p;
+  char *tmp = (char *)malloc(strlen(p->checkpoint) + 5);
+  long l;
+  int x;
+
+  sprintf(tmp, "%s.tmp", p->checkpoint);
+  FILE *f = fopen(tmp, "w");
+  if(f == NULL)
+  {
+    free(tmp);
+    return -1;
+  }
+  fprintf(f, "%s %d\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+  fprintf(f, "alpha %d\n", ALPHA);
+  fprintf(f, "keystream %d %016llx\n", sr->z_len, (unsigned long long)keystream_digest(sr->z, sr->z_len));
+  fprintf(f, "options %d %d %d %d %d\n", p->all, p->shard, p->nshards, p->shard_depth, p->order);
+  fprintf(f, "hints %016llx\n", (unsigned long long)hints_digest(p->hints));
+  fprintf(f, "root %d\n", sr->root_index);
+  fprintf(f, "depth %d\n", depth);
+  for(l=0;l<depth;l++)
+    fprintf(f, "path %d %d %d\n", ws->frames[l].si_start, ws->frames[l].sj_start, ws->frames[l].is_first);
+  fprintf(f, "solutions %ld\n", sr->found.count);
+  for(l=0;l<sr->found.cap;l++)
+  {
+    if(!sr->found.used[l])
+      continue;
+    solution_key *k = &sr->found.keys[l];
+    fprintf(f, "solution %d", k->j);
+    for(x=0;x<SIZE;x++)
+      fprintf(f, " %d", ((k->known[x>>6] >> (x&63)) & 1) ? k->s[x] : -1);
+    fprintf(f, "\n");
+  }
+  int err = ferror(f);
+  if(fclose(f) != 0 || err || rename(tmp, p->checkpoint) != 0)
+  {
+    free(tmp);
+    return -1;
+  }
+  free(tmp);
+  sr->saved = time(NULL);
+  DEBUG_PRINT(("save_checkpoint(): saved root %d, depth %d\n", sr->root_index, depth));
+  return 0;
+}
+
+/* Give up on resuming from a checkpoint
+ *
+ * @param sr Search, gets the reason in sr->error
+ * @param f Checkpoint file to close, or NULL
+ * @param what The reason
+ * @return -1
+*/
+static int checkpoint_error(search *sr, FILE *f, const char *what)
+{
+  if(f != NULL)
+    fclose(f);
+  sr->error = what;
+  return -1;
+}
+
+/* Load a checkpoint saved by save_checkpoint()
+ *
+ * The path goes to the frames of <ws> (only the step arguments, see
+ * replay()) and the solutions to sr->found.
+ *
+ * @param sr Search
+ * @param ws Workspace of the search
+ * @return Number of levels on the path, -1 (with the reason in sr->error)
+ *         if the checkpoint does not belong to this keystream and options
+*/
+static int load_checkpoint(search *sr, workspace *ws)
+{
+  struct recovery_params *p = sr->p;
+  char magic[64];
+  int version, alpha, z_len, all, shard, nshards, shard_depth, order, depth, x;
+  unsigned long long digest;
+  long count, l;
+
+  FILE *f = fopen(p->checkpoint, "r");
+  if(f == NULL)
+    return checkpoint_error(sr, NULL, "cannot open the file");
+  if(fscanf(f, "%63s %d", magic, &version) != 2 || strcmp(magic, CHECKPOINT_MAGIC) != 0 || version != CHECKPOINT_VERSION)
+    return checkpoint_error(sr, f, "not a checkpoint");
+  if(fscanf(f, " alpha %d", &alpha) != 1 || alpha != ALPHA)
+    return checkpoint_error(sr, f, "different word size");
+  if(fscanf(f, " keystream %d %llx", &z_len, &digest) != 2 || z_len != sr->z_len || digest != keystream_digest(sr->z, sr->z_len))
+    return checkpoint_error(sr, f, "different keystream");
+  if(fscanf(f, " options %d %d %d %d %d", &all, &shard, &nshards, &shard_depth, &order) != 5 || all != p->all ||
+     shard != p->shard || nshards != p->nshards || shard_depth != p->shard_depth || order != p->order)
+    return checkpoint_error(sr, f, "different options (-a, --shard, --order)");
+  if(fscanf(f, " hints %llx", &digest) != 1 || digest != hints_digest(p->hints))
+    return checkpoint_error(sr, f, "different hints");
+  if(fscanf(f, " root %d depth %d", &sr->root_index, &depth) != 2 || depth < 0 || depth > z_len)
+    return checkpoint_error(sr, f, "corrupted path");
+  for(l=0;l<depth;l++)
+  {
+    frame *fr = &ws->frames[l];
+    if(fscanf(f, " path %d %d %d", &fr->si_start, &fr->sj_start, &fr->is_first) != 3)
+      return checkpoint_error(sr, f, "corrupted path");
+  }
+  if(fscanf(f, " solutions %ld", &count) != 1)
+    return checkpoint_error(sr, f, "corrupted solutions");
+  for(l=0;l<count;l++)
+  {
+    solution_key k;
+    int v;
+    memset(&k, 0, sizeof(k));
+    if(fscanf(f, " solution %d", &k.j) != 1)
+      return checkpoint_error(sr, f, "corrupted solutions");
+    for(x=0;x<SIZE;x++)
+    {
+      if(fscanf(f, "%d", &v) != 1 || v < -1 || v >= SIZE)
+        return checkpoint_error(sr, f, "corrupted solutions");
+      if(v >= 0)
+      {
+        k.s[x] = v;
+        k.known[x>>6] |= 1ULL << (x&63);
+      }
+    }
+    if(solution_set_insert(&sr->found, &k) < 0)
+      return checkpoint_error(sr, f, "out of memory");
+  }
+  fclose(f);
+  return depth;
+}
+
+/* Rebuild the candidate and the frames of a loaded path
+ *
+ * Every level re-applies update_state() to the parent (as bt() did before
+ * calling first()) and derives the child with the saved step arguments.
+ *
+ * @param c Root candidate; becomes the candidate the search stopped at
+ * @param ws Workspace with the path from load_checkpoint()
+ * @param sr Search
+ * @param depth Number of levels on the path
+ * @return 0, -1 (with the reason in sr->error) if the path does not match the keystream
+*/
+static int replay(candidate *c, workspace *ws, search *sr, int depth)
+{
+  int l;
+  for(l=0;l<depth;l++)
+  {
+    frame *f = &ws->frames[l];
+    if(update_state(c, &ws->tr, sr->z) < 0)
+      return checkpoint_error(sr, NULL, "the path does not match the keystream");
+    f->i = c->i;
+    f->j = c->j;
+    f->t = c->t;
+    f->mark = ws->tr.top;
+    f->path = c->path;
+#ifdef CONFLICT_STATS
+    f->dep_j = c->dep_j;
+    f->conflict = 0;
+#endif
+    if(derive(c, f, &ws->tr, f->si_start, f->sj_start, f->is_first, ws->ord) != 0)
+      return checkpoint_error(sr, NULL, "the path does not match the keystream");
+    c->t++;
+  }
+  return 0;
+}
+
+/* Has the caller asked the search to stop? Polled at every node
+ *
+ * @param sr Search
+ * @param nodes Nodes checked by the calling thread so far (ws->polled)
+ * @return RECOVERY_DONE to go on, or why to stop
+*/
+static inline int stop_requested(search *sr, long nodes)
+{
+  struct recovery_params *p = sr->p;
+  if(p->interrupt != NULL && *p->interrupt && p->checkpoint != NULL && p->nworkers == 1)
+    return RECOVERY_INTERRUPTED;
+  if(p->cancel != NULL && *p->cancel)
+    return RECOVERY_CANCELLED;
+  if(p->max_nodes > 0 && (nodes & 0x3ff) == 0 && atomic_fetch_add(&sr->spent, 0x400) + 0x400 >= p->max_nodes)
+    return RECOVERY_BUDGET;
+  return RECOVERY_DONE;
+}
+
+#ifdef CONFLICT_STATS
+#define NOT_JUMPED (-2)
+
+/* The candidate derived by frame <depth>-1 is dead: its conflict set, less
+ * that frame's own guesses, goes to the frame's conflict set */
+static void dead_child(workspace *ws, candidate *c, int depth)
+{
+  if(depth > 0)
+    ws->frames[depth-1].conflict |= c->conflict & BELOW(depth-1);
+}
+
+/* Frame <e> has no children left. Chronological backtracking goes on with
+ * the next child of frame <e>-1, backjumping with that of the deepest frame
+ * in the conflict set of <e>, which inherits the rest of the set. Until
+ * the search gets back to the latter, the nodes it visits are ones that
+ * backjumping would skip (ws->jumped_to is set meanwhile).
+*/
+static void backjump(workspace *ws, int e)
+{
+  frame *frames = ws->frames;
+  if(ws->jumped_to != NOT_JUMPED)
+  {
+    if(e == ws->jumped_to+1) // frame jumped_to goes on with its next child
+      ws->jumped_to = NOT_JUMPED;
+    return;
+  }
+  uint64_t cs = frames[e].conflict & BELOW(e);
+  int h = cs != 0 ? 63 - __builtin_clzll(cs) : -1; // -1: no child of the root can work out
+  if(h >= 0)
+    frames[h].conflict |= cs & BELOW(h);
+  if(h < e-1)
+    ws->jumped_to = h;
+}
+# define NOTE_DEAD(ws,c,depth) dead_child(ws, c, depth)
+#else
+# define NOTE_DEAD(ws,c,depth)
+#endif
+
+/* Main backtracking procedure
+
+   Takes a solution candidate, updates/checks for contradictions of
+   its permutation <s> based on the current byte in the key stream
+   (and the next ones, if lookahead is enabled).
+   If there are not contradiction, make another step (i.e. read the next
+   keystream byte), and go one level deeper.
+   If the end of the keystream is reached, record the candidate
+   in <sr> and stop the search (or go on with the siblings when
+   enumerating all solutions).
+
+   The tree is walked with an explicit stack of frames: the candidate
+   is modified in place and rolled back through the trail when
+   backtracking, so nothing is copied per level and long keystreams
+   do not grow the call stack.
+
+   Backtracking is chronological on purpose. A frame whose guesses run
+   out has tried every value that is not used yet, and each used value
+   rules one out, so its conflict set holds every frame above it that
+   guessed one of them, i.e. every frame with a guess: conflict-directed
+   backjumping would go on with the previous guess, just like next().
+   Only a frame without a guess (it has a single child) can jump further,
+   when the contradiction of its child does not involve the guesses right
+   above it. The instrumented build (make VERBOSE=-DCONFLICT_STATS) keeps
+   the conflict sets and counts the nodes backjumping would skip: with -a
+   on the 30 byte keystreams of six keys at ALPHA=4 that is 0.8-1.3% of
+   the nodes (35340 of 4498189 to 106180 of 8357967), none with -l 3, and
+   keeping the sets makes the search about 25% slower.
+   Learned nogoods keyed by the partial state do not pay off either:
+   different guesses never lead to the same (t, j, S), not once in
+   about 10^6 surviving candidates of a hard ALPHA=4 keystream.
+
+   The sequential search saves its position every p->checkpoint_interval
+   seconds if p->checkpoint is set, and stops after saving it when
+   p->interrupt gets set. Every thread stops when p->cancel gets set or
+   p->max_nodes are used up (saving a checkpoint, too, if there is one).
+
+   A thread with a node budget (ws->budget >= 0) gives up once it has
+   checked that many candidates.
+
+   @param c Current candidate with partially filled permutation (modified)
+   @param ws Workspace (trail and frames) of the calling thread
+   @param sr Search (keystream and stop flag)
+   @param depth Number of frames in use: the levels above <c>
+   @return 1 if the search should stop (solution found), 0 otherwise,
+           -1 if the node budget ran out
+*/
+static int bt_loop(candidate *c, workspace *ws, search *sr, int depth)
+{
+  frame *frames = ws->frames;
+  struct recovery_params *p = sr->p;
+  int ret = 0;
+#ifdef CONFLICT_STATS
+  ws->jumped_to = NOT_JUMPED;
+#endif
+
+  while(1)
+  {
+    if(atomic_load_explicit(&sr->stop, memory_order_relaxed))
+      return 1;
+    if(ws->budget >= 0 && ws->budget-- == 0)
+      return -1;
+    int why = stop_requested(sr, ++ws->polled);
+    if(why != RECOVERY_DONE)
+    {
+      if(p->checkpoint != NULL && p->nworkers == 1 && save_checkpoint(sr, ws, depth) < 0)
+        sr->save_failures++;
+      halt(sr, why, NULL);
+      return 1;
+    }
+    if(p->checkpoint != NULL && p->nworkers == 1 && (ws->polled & 0xffff) == 0 && time(NULL) - sr->saved >= p->checkpoint_interval)
+      if(save_checkpoint(sr, ws, depth) < 0)
+        sr->save_failures++;
+    if(sr->p->progress != NULL && *sr->p->progress)
+      poll_progress(sr);
+    DEBUG_PRINT(("\n============================================\n"));
+    DEBUG_PRINT((" ==> Checking candidate (t=%d).\n", c->t));
+    DEBUG_PRINT((" => Update and check.\n"));
+#ifdef CONFLICT_STATS
+    if(ws->jumped_to != NOT_JUMPED)
+      ws->skipped++;
+#endif
+    if(check_candidate(c, ws, sr) < 0)  // check for contradiction
+    {
+      DEBUG_PRINT((" ==> Dead candidate\n"));
+      NOTE_DEAD(ws, c, depth);
+      ret = 2; // try its siblings
+    }
+    else
+    {
+      DEBUG_PRINT(("The updated candidate is:\n"));
+#ifdef DEBUG
+      debug_print_candidate(c);
+#endif
+      int len = keystream_len(sr, ws, c->t+2);
+      int sim = c->t < len-1 ? simulate(c, ws, sr, len) : 0;
+      if(sim < 0)
+      {
+        DEBUG_PRINT((" ==> Determined candidate does not reproduce the keystream\n"));
+        ws->stats.dead[c->t+1]++;
+        ws->stats.pruned[PRUNE_SIMULATION]++;
+        NOTE_CONFLICT(c, placed(c));
+        NOTE_DEAD(ws, c, depth);
+        ret = 2;
+      }
+      else if(at_end(c, ws, sr)) // at the end of the keystream, maybe through simulate()
+      {
+        if(report_solution(sr, c, ws->member))
+          return 1;
+        NOTE_CONFLICT(c, ~0ULL); // every frame has to try its other children
+        NOTE_DEAD(ws, c, depth);
+        ret = 2; // exhaustive mode: go on with the siblings
+      }
+      else
+      {
+        DEBUG_PRINT(("\n\n\n => Getting first candidate (t=%d).\n", c->t));
+        ret = first(c, &frames[depth++], &ws->tr, ws->ord); // Do step here
+      }
+    }
+
+    while(ret != 0)
+    {
+      if(ret == 1)
+      {
+        DEBUG_PRINT(("bt(): Parsed all children, none worked out. Going one level up.\n"));
+        depth--;
+#ifdef CONFLICT_STATS
+        backjump(ws, depth);
+#endif
+      }
+      else
+      {
+        DEBUG_PRINT(("bt(): skipping candidate (ret=%d).\n",ret));
+      }
+      if(depth == 0)
+        return 0;
+      DEBUG_PRINT(("\n\n\n => Choosing next candidate (t=%d).\n", frames[depth-1].t));
+      ret = next(c, &frames[depth-1], &ws->tr, ws->ord); // next will be derived from the parent in the frame
+    }
+#ifdef DEBUG
+    debug_print_candidate(c);
+#endif
+    c->t++;
+    DEBUG_PRINT(("bt(): going deeper to level %d.\n",c->t));
+  }
+}
+
+int bt(candidate *c, workspace *ws, search *sr)
+{
+  return bt_loop(c, ws, sr, 0);
+}
+
+/* Allocate trail and frames for a keystream of <z_len> bytes
+ *
+ * @param ws Workspace to initialize (to be released with workspace_free()
+ *        even if this fails)
+ * @param z_len Lenght of the keystream
+ * @return 0, -1 if there is not enough memory
+*/
+int workspace_init(workspace *ws, int z_len)
+{
+  // Every entry is assigned at most once along a path, plus a swap per level
+  ws->tr.entries = (undo *)malloc((SIZE + z_len + 2)*sizeof(undo));
+  ws->tr.top = 0;
+  ws->avail = 0;
+  ws->ord = NULL;
+  ws->budget = -1;
+  ws->polled = 0;
+  ws->member = 0;
+#ifdef CONFLICT_STATS
+  ws->jumped_to = NOT_JUMPED;
+  ws->skipped = 0;
+#endif
+  ws->frames = (frame *)malloc((z_len + 2)*sizeof(frame));
+  recovery_stats_init(&ws->stats, z_len);
+  if(ws->tr.entries == NULL || ws->frames == NULL || ws->stats.nodes == NULL || ws->stats.dead == NULL)
+    return -1;
+  return 0;
+}
+
+/* Release the memory of a workspace
+*/
+void workspace_free(workspace *ws)
+{
+  free(ws->tr.entries);
+  free(ws->frames);
+  recovery_stats_free(&ws->stats);
+}
+
+/* Parallel search
+ *
+ * The top of the search tree (candidates with t < split_depth) is
+ * shared between worker threads as "open nodes": a candidate which
+ * passed update_state() together with the cursor of its first()/next()
+ * sibling enumeration. A worker takes the deepest open node from its own
+ * deque, derives the next child and puts the node back, so that idle
+ * workers can steal the remaining siblings from the shallow end.
+ * Children at split_depth are explored by the sequential bt().
+*/
+
+struct task_struct
+{
+  candidate c; // parent candidate (update_state() already applied)
+  frame f; // guesses of the last child derived from <c> with first()/next()
+  int started; // 0 if first() was not called for <c> yet
+};
+
+typedef struct task_struct task;
+
+struct deque_struct
+{
+  task *tasks;
+  int head; // thieves take from here (shallow nodes)
+  int tail; // the owner pushes and pops here (deep nodes)
+  int cap;
+  pthread_mutex_t lock;
+};
+
+typedef struct deque_struct deque;
+
+struct pool_struct;
+
+struct worker_struct
+{
+  int id;
+  unsigned int seed; // for choosing a victim to steal from
+  deque dq;
+  workspace ws;
+  struct pool_struct *p;
+  pthread_t thread;
+};
+
+typedef struct worker_struct worker;
+
+struct pool_struct
+{
+  search *sr;
+  int nworkers;
+  int split_depth; // nodes with t below this are shared between workers
+  atomic_int pending; // open nodes in deques or being expanded
+  worker *workers;
+  pthread_mutex_t idle_lock; // protects the wait on <work>
+  pthread_cond_t work; // signalled when a task is pushed or <pending> drops to 0
+  atomic_int idle; // workers waiting on <work>
+};
+
+typedef struct pool_struct pool;
+
+/* Push a task to the owner's end of the deque
+ *
+ * @param dq Deque to push to
+ * @param tk Task to push
+ * @return void
+*/
+static int deque_push(deque *dq, task *tk)
+{
+  pthread_mutex_lock(&dq->lock);
+  if(dq->tail == dq->cap)
+  {
+    // Compact the stolen prefix away first, grow only if still full
+    memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head)*sizeof(task));
+    dq->tail -= dq->head;
+    dq->head = 0;
+    if(dq->tail == dq->cap)
+    {
+      task *tasks = (task *)realloc(dq->tasks, 2*dq->cap*sizeof(task));
+      if(tasks == NULL)
+      {
+        pthread_mutex_unlock(&dq->lock);
+        return -1;
+      }
+      dq->tasks = tasks;
+      dq->cap *= 2;
+    }
+  }
+  dq->tasks[dq->tail++] = *tk;
+  pthread_mutex_unlock(&dq->lock);
+  return 0;
+}
+
+/* Take a task from the owner's end (or the thieves' end) of the deque
+ *
+ * @param dq Deque to take from
+ * @param tk The task is copied here
+ * @param steal If set, take the oldest (shallowest) task
+ * @return 1 if a task was taken, 0 if the deque is empty
+*/
+static int deque_take(deque *dq, task *tk, int steal)
+{
+  int ok = 0;
+  pthread_mutex_lock(&dq->lock);
+  if(dq->head < dq->tail)
+  {
+    *tk = steal ? dq->tasks[dq->head++] : dq->tasks[--dq->tail];
+    if(dq->head == dq->tail)
+      dq->head = dq->tail = 0;
+    ok = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return ok;
+}
+
+/* Find work for worker <w>: its own deque first, then the other workers'
+ *
+ * @param w Worker looking for a task
+ * @param tk The task is copied here
+ * @return 1 if a task was found, 0 otherwise
+*/
+static int find_task(worker *w, task *tk)
+{
+  pool *p = w->p;
+  int l;
+
+  if(deque_take(&w->dq, tk, 0))
+    return 1;
+
+  int victim = rand_r(&w->seed) % p->nworkers;
+  for(l=0;l<p->nworkers;l++)
+  {
+    worker *v = &p->workers[(victim + l) % p->nworkers];
+    if(v != w && deque_take(&v->dq, tk, 1))
+      return 1;
+  }
+  return 0;
+}
+
+/* Wake the idle workers after a push, or all of them once <pending> is 0 */
+static void wake_idle(pool *p, int all)
+{
+  if(atomic_load(&p->idle) == 0)
+    return;
+  pthread_mutex_lock(&p->idle_lock);
+  if(all)
+    pthread_cond_broadcast(&p->work);
+  else
+    pthread_cond_signal(&p->work);
+  pthread_mutex_unlock(&p->idle_lock);
+}
+
+/* Wait for work while other workers hold all of it
+ *
+ * The wait is bounded (1 ms), so a stop request set from outside the
+ * pool (or a wakeup missed between find_task() and the wait) only
+ * delays the worker a little.
+*/
+static void wait_idle(pool *p)
+{
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += 1000000;
+  if(until.tv_nsec >= 1000000000)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&p->idle_lock);
+  atomic_fetch_add(&p->idle, 1);
+  if(atomic_load(&p->pending) > 0 && !atomic_load(&p->sr->stop))
+    pthread_cond_timedwait(&p->work, &p->idle_lock, &until);
+  atomic_fetch_sub(&p->idle, 1);
+  pthread_mutex_unlock(&p->idle_lock);
+}
+
+/* Derive the next child of an open node and deal with it
+ *
+ * The node goes back to the worker's deque while it has children left.
+ * Shallow children become open nodes themselves, deeper ones are
+ * explored with bt().
+ *
+ * @param w Worker that owns the node
+ * @param tk Open node
+ * @return void
+*/
+static void expand_task(worker *w, task *tk)
+{
+  pool *p = w->p;
+  search *sr = p->sr;
+  workspace *ws = &w->ws;
+  candidate *c = &ws->c;
+  int ret = 0;
+
+  *c = tk->c;
+  ws->tr.top = 0;
+  if(tk->started)
+    ret = next(c, &tk->f, &ws->tr, ws->ord);
+  else
+    ret = first(c, &tk->f, &ws->tr, ws->ord);
+  tk->started = 1;
+
+  if(ret == 1) // all children were enumerated
+  {
+    if(atomic_fetch_sub(&p->pending, 1) == 1)
+      wake_idle(p, 1);
+    return;
+  }
+  if(deque_push(&w->dq, tk) < 0) // let others take the remaining siblings
+    halt(sr, RECOVERY_ERROR, "out of memory");
+  wake_idle(p, 0);
+  if(ret == 2)
+    return;
+
+  c->t++;
+  if(c->t >= p->split_depth)
+  {
+    bt(c, ws, sr);
+    return;
+  }
+
+  if(check_candidate(c, ws, sr) < 0)
+    return;
+  if(at_end(c, ws, sr))
+  {
+    report_solution(sr, c, 0);
+    return;
+  }
+  task child;
+  child.c = *c;
+  child.started = 0;
+  atomic_fetch_add(&p->pending, 1);
+  if(deque_push(&w->dq, &child) < 0)
+    halt(sr, RECOVERY_ERROR, "out of memory");
+  wake_idle(p, 0);
+}
+
+/* Worker thread: expand open nodes until the tree is exhausted
+ * or a solution is found
+*/
+static void *worker_main(void *arg)
+{
+  worker *w = (worker *)arg;
+  pool *p = w->p;
+  task tk;
+
+  while(!atomic_load_explicit(&p->sr->stop, memory_order_relaxed))
+  {
+    if(p->sr->p->progress != NULL && *p->sr->p->progress)
+      poll_progress(p->sr);
+    if(find_task(w, &tk))
+      expand_task(w, &tk);
+    else if(atomic_load(&p->pending) == 0)
+      break;
+    else
+      wait_idle(p);
+  }
+  return NULL;
+}
+
+/* Explore the search trees below <roots> with <nworkers> threads
+ *
+ * The roots are spread over the workers' deques, so several roots
+ * (e.g. one per value of j with hints) are raced against each other.
+ *
+ * @param roots Root candidates
+ * @param nroots Number of root candidates
+ * @param sr Search (keystream and stop flag)
+ * @param nworkers Number of worker threads
+ * @param split_depth Candidates with t below this are shared between workers
+ * @return void
+*/
+static void parallel_bt(candidate *roots, int nroots, search *sr, int nworkers, int split_depth)
+{
+  pool p;
+  int l;
+
+  p.sr = sr;
+  p.nworkers = nworkers;
+  p.split_depth = split_depth;
+  atomic_init(&p.pending, 0);
+  atomic_init(&p.idle, 0);
+  p.workers = (worker *)calloc(nworkers, sizeof(worker));
+  if(p.workers == NULL)
+  {
+    halt(sr, RECOVERY_ERROR, "out of memory");
+    return;
+  }
+  pthread_mutex_init(&p.idle_lock, NULL);
+  pthread_cond_init(&p.work, NULL);
+  for(l=0;l<nworkers;l++)
+  {
+    worker *w = &p.workers[l];
+    w->id = l;
+    w->seed = l + 1;
+    w->p = &p;
+    w->dq.cap = split_depth + 2;
+    w->dq.tasks = (task *)malloc(w->dq.cap*sizeof(task));
+    w->dq.head = w->dq.tail = 0;
+    pthread_mutex_init(&w->dq.lock, NULL);
+    if(workspace_init(&w->ws, sr->z_len) < 0 || w->dq.tasks == NULL)
+      halt(sr, RECOVERY_ERROR, "out of memory");
+    w->ws.ord = sr->ord;
+  }
+
+  int n = 0;
+  for(l=0;l<nroots && !atomic_load(&sr->stop);l++)
+  {
+    task tk;
+    tk.c = roots[l];
+    tk.started = 0;
+    p.workers[0].ws.tr.top = 0;
+    if(check_candidate(&tk.c, &p.workers[0].ws, sr) < 0)
+      continue;
+    if(at_end(&tk.c, &p.workers[0].ws, sr))
+    {
+      report_solution(sr, &tk.c, 0);
+      continue;
+    }
+    atomic_fetch_add(&p.pending, 1);
+    if(deque_push(&p.workers[n++ % nworkers].dq, &tk) < 0)
+      halt(sr, RECOVERY_ERROR, "out of memory");
+  }
+
+  struct recovery_stats **live = (struct recovery_stats **)malloc(nworkers*sizeof(*live));
+  if(live == NULL)
+    halt(sr, RECOVERY_ERROR, "out of memory");
+  else
+  {
+    for(l=0;l<nworkers;l++)
+      live[l] = &p.workers[l].ws.stats;
+    sr->live = live;
+    sr->nlive = nworkers;
+  }
+  if(n > 0 && !atomic_load(&sr->stop)) // not after a failure above
+  {
+    for(l=0;l<nworkers;l++)
+      pthread_create(&p.workers[l].thread, NULL, worker_main, &p.workers[l]);
+    for(l=0;l<nworkers;l++)
+      pthread_join(p.workers[l].thread, NULL);
+  }
+
+  for(l=0;l<nworkers;l++)
+  {
+    recovery_stats_add(&sr->total, &p.workers[l].ws.stats);
+    pthread_mutex_destroy(&p.workers[l].dq.lock);
+    free(p.workers[l].dq.tasks);
+    workspace_free(&p.workers[l].ws);
+  }
+  sr->nlive = 0;
+  free(live);
+  free(p.workers);
+  pthread_cond_destroy(&p.work);
+  pthread_mutex_destroy(&p.idle_lock);
+}
+
+/* Root candidates of a search that starts from p->hints
+ *
+ * The hinted entries are known in every root. A hinted position t >= 0 is
+ * searched from keystream offset t: z[0..t-1] are not checked, and
+ * without a hinted j there is a root for every value of j. Each root is
+ * checked against z[t] with update_state() before anything is guessed.
+ *
+ * @param p Search options
+ * @param nroots The number of roots is written here, 0 if the hints
+ *        contradict each other
+ * @return Array of roots, free() it; NULL (and no roots) if out of memory
+*/
+static candidate *hinted_roots(struct recovery_params *p, int *nroots)
+{
+  struct recovery_hints *h = p->hints;
+  candidate *roots = (candidate *)malloc(SIZE*sizeof(candidate));
+  candidate c = root();
+  undo entries[SIZE];
+  trail tr = { entries, 0 };
+  int l, g;
+
+  *nroots = 0;
+  if(roots == NULL)
+    return NULL;
+  for(l=0;l<h->n;l++)
+  {
+    int x = h->x[l];
+    int v = h->v[l];
+    if(KNOWN(&c,x) && c.s[x] == v)
+      continue; // given twice
+    if(KNOWN(&c,x) || USED(&c,v))
+      return roots;
+    assign(&c, &tr, x, v);
+  }
+  if(h->t < 0)
+  {
+    if(h->j > 0)
+      return roots; // j starts at 0
+    roots[(*nroots)++] = c;
+    return roots;
+  }
+  c.t = h->t;
+  c.i = ind(h->t+1);
+  c.start = h->t;
+  for(g=0;g<SIZE;g++)
+  {
+    if(h->j >= 0 && g != h->j)
+      continue;
+    c.j = g;
+    c.path = path_mix(0, h->t, g);
+    roots[(*nroots)++] = c;
+  }
+  return roots;
+}
+
+/* Root candidates of the search
+ *
+ * The usual root at the start of the keystream (see root()), or those of
+ * p->hints (see hinted_roots()).
+ *
+ * @param p Search options
+ * @param nroots The number of roots is written here
+ * @return Array of roots, free() it; NULL (and no roots) if out of memory
+*/
+static candidate *make_roots(struct recovery_params *p, int *nroots)
+{
+  if(p->hints != NULL)
+    return hinted_roots(p, nroots);
+  candidate *roots = (candidate *)malloc(sizeof(candidate));
+  *nroots = 0;
+  if(roots == NULL)
+    return NULL;
+  roots[0] = root();
+  *nroots = 1;
+  return roots;
+}
+
+/* Portfolio
+ *
+ * How long the search takes depends on where the solution lies in the
+ * order of the guesses, which varies a lot from keystream to keystream.
+ * A portfolio runs p->portfolio differently configured members on the
+ * same keystream, one thread each, and the first one to reach the end of
+ * the keystream stops the others:
+ *
+ *   member 0   the search as configured (p->order), never restarted
+ *   member 1   the other deterministic order, never restarted
+ *   member 2+  ORDER_RANDOM, drawn again from a new seed whenever run k
+ *              has checked luby(k)*p->restart_unit candidates
+ *
+ * All members start where the search would start without a portfolio.
+ * A member which gets through its tree within its budget has shown that
+ * there is no solution, so it stops the others, too; member 0 always
+ * can, which keeps the portfolio complete.
+*/
+
+struct member_struct
+{
+  int id;
+  search *sr;
+  candidate *roots; // roots of the search, shared by all members
+  int nroots;
+  ordering order;
+  workspace ws;
+  long restarts;
+  pthread_t thread;
+};
+
+typedef struct member_struct member;
+
+/* The Luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ... for k >= 1 */
+static long luby(long k)
+{
+  while(1)
+  {
+    int e = 1;
+    while((1L << e) - 1 < k)
+      e++;
+    if(k == (1L << e) - 1)
+      return 1L << (e-1);
+    k -= (1L << (e-1)) - 1;
+  }
+}
+
+/* Portfolio member thread: search from the member's roots, restarting
+ * randomized members when their budget runs out
+*/
+static void *member_main(void *arg)
+{
+  member *m = (member *)arg;
+  search *sr = m->sr;
+  workspace *ws = &m->ws;
+  long unit = sr->p->restart_unit > 0 ? sr->p->restart_unit : DEFAULT_RESTART_UNIT;
+  long run;
+  int l, ret = 0;
+
+  for(run=1;;run++)
+  {
+    if(m->order.policy == ORDER_RANDOM)
+    {
+      shuffle_values(&m->order, ((uint64_t)m->id << 32 | run) * 0x9e3779b97f4a7c15ULL | 1);
+      ws->budget = luby(run) * unit;
+    }
+    ret = 0;
+    for(l=0;l<m->nroots && ret == 0;l++)
+    {
+      ws->c = m->roots[l];
+      ws->tr.top = 0;
+      ret = bt_loop(&ws->c, ws, sr, 0);
+    }
+    if(ret >= 0)
+      break;
+    m->restarts++;
+  }
+  if(ret == 0) // no solution at all
+    halt(sr, RECOVERY_DONE, NULL);
+  return NULL;
+}
+
+/* Race the members of a portfolio
+ *
+ * @param roots Roots of the search without a portfolio
+ * @param nroots Number of these roots
+ * @param sr Search (keystream and stop flag)
+ * @return Restarts of all members
+*/
+static long run_portfolio(candidate *roots, int nroots, search *sr)
+{
+  struct recovery_params *p = sr->p;
+  int n = p->portfolio;
+  member *members = (member *)calloc(n, sizeof(member));
+  struct recovery_stats **live = (struct recovery_stats **)malloc(n*sizeof(*live));
+  long restarts = 0;
+  int l;
+
+  if(members == NULL || live == NULL)
+  {
+    halt(sr, RECOVERY_ERROR, "out of memory");
+    free(members);
+    free(live);
+    return 0;
+  }
+  pthread_once(&prior_once, init_prior);
+
+  for(l=0;l<n;l++)
+  {
+    member *m = &members[l];
+    m->id = l;
+    m->sr = sr;
+    m->roots = roots;
+    m->nroots = nroots;
+    m->order.z = p->z;
+    if(l == 0)
+      m->order.policy = p->order;
+    else if(l == 1)
+      m->order.policy = p->order == ORDER_ASCENDING ? ORDER_BIASED : ORDER_ASCENDING;
+    else
+    {
+      m->order.policy = ORDER_RANDOM;
+      m->order.values = (uint8_t *)malloc(SIZE*SIZE);
+    }
+    if(workspace_init(&m->ws, sr->z_len) < 0 || (m->order.policy == ORDER_RANDOM && m->order.values == NULL))
+      halt(sr, RECOVERY_ERROR, "out of memory");
+    m->ws.ord = m->order.policy == ORDER_ASCENDING ? NULL : &m->order;
+    m->ws.member = l;
+    live[l] = &m->ws.stats;
+  }
+  sr->live = live;
+  sr->nlive = n;
+  if(!atomic_load(&sr->stop)) // not after a failure above
+  {
+    for(l=0;l<n;l++)
+      pthread_create(&members[l].thread, NULL, member_main, &members[l]);
+    for(l=0;l<n;l++)
+      pthread_join(members[l].thread, NULL);
+  }
+
+  for(l=0;l<n;l++)
+  {
+    recovery_stats_add(&sr->total, &members[l].ws.stats);
+    restarts += members[l].restarts;
+    workspace_free(&members[l].ws);
+    free(members[l].order.values);
+  }
+  sr->nlive = 0;
+  free(live);
+  free(members);
+  return restarts;
+}
+
+/* Recover the RC4 state at the end of keystream <p->z>
+ *
+ * Safe to call from several threads at once: all state lives in <p>, <res>
+ * and memory of the call itself, and nothing is printed. Why the search
+ * stopped is in res->status.
+ *
+ * @param p Keystream and search options
+ * @param res The recovered state is written here (default mode only)
+ * @return Number of distinct states consistent with the keystream that
+ *         were found: at most 1 in the default mode, all of them if
+ *         p->all is set (unless the callback stopped the search);
+ *         -1 if the search failed (res->status and res->error tell why)
+*/
+long recover(struct recovery_params *p, struct recovery_result *res)
+{
+  search sr;
+  int nroots, l;
+  int portfolio = p->portfolio > 1 && !p->all && p->checkpoint == NULL && p->nshards == 1;
+  long restarts = 0;
+  sr.z = p->z;
+  sr.z_len = p->z_len;
+  sr.p = p;
+  memset(&sr.found, 0, sizeof(sr.found));
+  atomic_init(&sr.stop, 0);
+  recovery_stats_init(&sr.total, p->z_len);
+  sr.live = NULL;
+  sr.nlive = 0;
+  sr.order.policy = p->order;
+  sr.order.z = p->z;
+  sr.ord = p->order == ORDER_ASCENDING ? NULL : &sr.order;
+  if(sr.ord != NULL)
+    pthread_once(&prior_once, init_prior);
+  sr.root_index = 0;
+  sr.saved = time(NULL);
+  sr.halted = 0;
+  sr.status = RECOVERY_DONE;
+  sr.error = NULL;
+  sr.save_failures = 0;
+  atomic_init(&sr.spent, 0);
+  sr.winner = 0;
+  pthread_mutex_init(&sr.lock, NULL);
+
+  candidate *roots = make_roots(p, &nroots);
+  if(roots == NULL)
+    halt(&sr, RECOVERY_ERROR, "out of memory");
+  if(p->hints != NULL && p->feed != NULL && nroots > 0 && feed_wait(p->feed, p->hints->t+1) <= p->hints->t)
+    nroots = 0; // the keystream ends before the hints
+  DEBUG_PRINT(("Root candidate:\n"));
+#ifdef DEBUG
+  if(nroots > 0)
+    debug_print_candidate(&roots[0]);
+#endif
+  if(portfolio)
+    restarts = run_portfolio(roots, nroots, &sr);
+  else if(p->nworkers > 1)
+    parallel_bt(roots, nroots, &sr, p->nworkers, p->split_depth);
+  else
+  {
+    workspace ws;
+    if(workspace_init(&ws, p->z_len) < 0)
+      halt(&sr, RECOVERY_ERROR, "out of memory");
+    ws.ord = sr.ord;
+    struct recovery_stats *live = &ws.stats;
+    sr.live = &live;
+    sr.nlive = 1;
+    int depth = 0;
+    if(p->checkpoint != NULL && p->resume && !atomic_load(&sr.stop))
+    {
+      depth = load_checkpoint(&sr, &ws);
+      if(depth >= 0 && (sr.root_index < 0 || sr.root_index >= nroots))
+        depth = checkpoint_error(&sr, NULL, "corrupted path");
+      if(depth < 0)
+        halt(&sr, RECOVERY_BAD_CHECKPOINT, sr.error);
+    }
+    for(l=sr.root_index;l<nroots && !atomic_load(&sr.stop);l++)
+    {
+      sr.root_index = l;
+      ws.c = roots[l];
+      ws.tr.top = 0;
+      if(replay(&ws.c, &ws, &sr, depth) < 0)
+      {
+        halt(&sr, RECOVERY_BAD_CHECKPOINT, sr.error);
+        break;
+      }
+      if(bt_loop(&ws.c, &ws, &sr, depth))
+        break;
+      depth = 0;
+    }
+    if(p->checkpoint != NULL && sr.status == RECOVERY_DONE)
+      remove(p->checkpoint); // the search is over
+#ifdef CONFLICT_STATS
+    if(p->z_len <= 64) // one bit per frame
+      fprintf(stderr, "Backjumping would skip %ld of %ld nodes\n", ws.skipped, recovery_stats_total(&ws.stats));
+#endif
+    sr.nlive = 0;
+    recovery_stats_add(&sr.total, &ws.stats);
+    workspace_free(&ws);
+  }
+  free(roots);
+
+  long found;
+  if(p->all)
+    found = sr.found.count;
+  else
+    found = atomic_load(&sr.stop) && !sr.halted;
+  res->status = sr.status;
+  res->error = sr.error;
+  res->checkpoint_failures = sr.save_failures;
+  if(found && !p->all)
+    export_candidate(&sr.solution, res);
+  res->member = sr.winner;
+  res->restarts = restarts;
+  res->nodes = recovery_stats_total(&sr.total);
+  if(p->stats != NULL)
+    recovery_stats_add(p->stats, &sr.total);
+  recovery_stats_free(&sr.total);
+  free(sr.found.keys);
+  free(sr.found.used);
+  pthread_mutex_destroy(&sr.lock);
+  if(sr.status == RECOVERY_BAD_CHECKPOINT || sr.status == RECOVERY_ERROR)
+    return -1;
+  return found;
+}
+
+/* Search tree size estimation
+ *
+ * Knuth's estimator: a probe walks from a random root down to a leaf. At
+ * every level it derives and checks all d children of its candidate, like
+ * the search does, and goes on with one of the a survivors, chosen at
+ * random. If the candidates above had a_0, a_1, ... survivors, the
+ * candidate stands in for W = a_0 a_1 ... of its level, so W d estimates
+ * the nodes on the level below, and the sum over the levels the nodes of
+ * the tree. The mean over the probes is an unbiased estimate of the nodes
+ * of the exhaustive search (-a); the search for the first state stops
+ * somewhere in that tree. The spread of the probes is large (they are
+ * products), so the confidence interval is only a rough guide.
+*/
+
+// Nodes of the real search timed to measure the speed
+#define CALIBRATION_NODES (1<<20)
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Check a candidate the way bt_loop() does: update_state(), lookahead and
+ * forward simulation
+ *
+ * @return 0 if it survives, -1 if it is dead
+*/
+static int probe_check(candidate *c, workspace *ws, search *sr)
+{
+  if(check_candidate(c, ws, sr) < 0)
+    return -1;
+  if(c->t < sr->z_len-1 && simulate(c, ws, sr, sr->z_len) < 0)
+    return -1;
+  return 0;
+}
+
+/* One probe from a random root to a leaf
+ *
+ * @param roots Roots of the search
+ * @param nroots Number of roots
+ * @param ws Workspace (only one frame is used)
+ * @param sr Search (keystream and options)
+ * @param seed State of rand_r()
+ * @return Estimated number of nodes of the tree
+*/
+static double probe(candidate *roots, int nroots, workspace *ws, search *sr, unsigned int *seed)
+{
+  candidate *c = &ws->c;
+  frame *f = &ws->frames[0];
+  frame chosen;
+  double w = nroots; // candidates the current one stands in for
+  double est = nroots; // the roots are nodes, too
+  int d, a, ret;
+
+  memset(&chosen, 0, sizeof(chosen));
+  *c = roots[rand_r(seed) % nroots];
+  ws->tr.top = 0;
+  if(probe_check(c, ws, sr) < 0)
+    return est;
+  while(!at_end(c, ws, sr))
+  {
+    d = 0;
+    a = 0;
+    for(ret=first(c, f, &ws->tr, ws->ord);ret!=1;ret=next(c, f, &ws->tr, ws->ord))
+    {
+      if(ret != 0)
+        continue;
+      d++;
+      c->t++;
+      if(probe_check(c, ws, sr) == 0 && rand_r(seed) % ++a == 0) // a uniform survivor
+        chosen = *f;
+    }
+    est += w*d;
+    if(a == 0)
+      break;
+    w *= a;
+    // derive the chosen child again, as next() would
+    rollback(c, &ws->tr, f->mark);
+    c->i = f->i;
+    c->j = f->j;
+    c->t = f->t;
+    c->path = f->path;
+    derive(c, f, &ws->tr, chosen.si_start, chosen.sj_start, chosen.is_first, ws->ord);
+    c->t++;
+    probe_check(c, ws, sr);
+  }
+  return est;
+}
+
+/**
+ * Estimate the size of the search tree of a keystream and the time to search it
+ *
+ * Takes <probes> Knuth probes (see above) and times CALIBRATION_NODES
+ * nodes of the real search. The options of <p> which shape the tree
+ * (lookahead, hints, shards) are taken into account; the
+ * keystream has to be complete.
+ *
+ * @param p Keystream and search options
+ * @param probes Number of probes, more give a tighter interval
+ * @param est The estimate goes here
+ * @return 0 on success, -1 if the estimate could not be made (est->error
+ *         tells why: the keystream is still arriving, or out of memory)
+*/
+int estimate(struct recovery_params *p, int probes, struct recovery_estimate *est)
+{
+  struct recovery_params q = *p; // the probes and the timing report nothing
+  search sr;
+  workspace ws;
+  unsigned int seed = 1;
+  double sum = 0, var = 0;
+  int nroots, l;
+
+  memset(est, 0, sizeof(*est));
+  if(p->feed != NULL || probes < 1)
+  {
+    est->status = RECOVERY_ERROR;
+    est->error = p->feed != NULL ? "the keystream is still arriving" : "no probes";
+    return -1;
+  }
+  q.on_solution = NULL;
+  q.stats = NULL;
+  q.progress = NULL;
+  q.checkpoint = NULL;
+  q.resume = 0;
+  q.max_nodes = 0; // the calibration has its own budget
+  memset(&sr, 0, sizeof(sr));
+  sr.z = p->z;
+  sr.z_len = p->z_len;
+  sr.p = &q;
+  atomic_init(&sr.stop, 0);
+  atomic_init(&sr.spent, 0);
+  recovery_stats_init(&sr.total, p->z_len);
+  sr.order.policy = p->order;
+  sr.order.z = p->z;
+  sr.ord = p->order == ORDER_ASCENDING ? NULL : &sr.order;
+  if(sr.ord != NULL)
+    pthread_once(&prior_once, init_prior);
+  pthread_mutex_init(&sr.lock, NULL);
+  candidate *roots = make_roots(p, &nroots);
+  double *x = (double *)calloc(probes, sizeof(double));
+  int ret = 0;
+  if(workspace_init(&ws, p->z_len) < 0 || x == NULL || roots == NULL)
+  {
+    est->status = RECOVERY_ERROR;
+    est->error = "out of memory";
+    nroots = 0;
+    ret = -1;
+  }
+  ws.ord = sr.ord;
+
+  est->probes = probes;
+  for(l=0;l<probes && nroots>0;l++)
+  {
+    x[l] = probe(roots, nroots, &ws, &sr, &seed);
+    sum += x[l];
+  }
+  est->nodes = sum/probes;
+  for(l=0;l<probes && est->nodes>0;l++) // relative to the mean: the squares of large trees overflow
+    var += (x[l]/est->nodes-1)*(x[l]/est->nodes-1);
+  free(x);
+  double half = probes > 1 ? 1.96*sqrt(var/(probes-1)/probes) : 0; // relative half width
+  est->low = est->nodes*(1-half) > 1 ? est->nodes*(1-half) : 1;
+  est->high = est->nodes*(1+half);
+
+  // Speed: the nodes of a budgeted sequential search (the whole tree if it is smaller)
+  recovery_stats_free(&ws.stats);
+  recovery_stats_init(&ws.stats, p->z_len);
+  ws.budget = CALIBRATION_NODES;
+  double t0 = now();
+  for(l=0;l<nroots;l++)
+  {
+    ws.c = roots[l];
+    ws.tr.top = 0;
+    if(bt_loop(&ws.c, &ws, &sr, 0) != 0)
+      break; // budget spent or a solution found (which stops the search)
+  }
+  double elapsed = now() - t0;
+  long nodes = recovery_stats_total(&ws.stats);
+  est->nodes_per_sec = elapsed > 0 ? nodes/elapsed : 0;
+  est->seconds = est->nodes_per_sec > 0 ? est->nodes/est->nodes_per_sec : 0;
+
+  workspace_free(&ws);
+  free(roots);
+  recovery_stats_free(&sr.total);
+  free(sr.found.keys);
+  free(sr.found.used);
+  pthread_mutex_destroy(&sr.lock);
+  return ret;
+}
+
+const struct recovery_kernels ALPHA_NAME(recovery_kernels) = { ALPHA, recover, estimate };
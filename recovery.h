@@ -0,0 +1,526 @@
+#ifndef __RECOVERY_H__
+#define __RECOVERY_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rc4prga.h"
+
+// Candidates with t below this are shared between threads in parallel mode
+#define DEFAULT_SPLIT_DEPTH (3)
+// Keystream bytes below the root at which the tree is split between shards
+#define DEFAULT_SHARD_DEPTH (3)
+// Node limit of the first run of a randomized portfolio member
+#define DEFAULT_RESTART_UNIT (1<<14)
+
+/* Why a candidate was rejected; update_state() returns the negated reason */
+enum prune_reason
+{
+  PRUNE_OCCUPIED = 1, // S[S[i]+S[j]] is known and differs from Z[t]
+  PRUNE_DUPLICATE, // Z[t] already appears at another index
+  PRUNE_SJ, // S[j] derived from Z[t] conflicts with the permutation
+  PRUNE_SI, // S[i] derived from Z[t] conflicts with the permutation
+  PRUNE_J, // j derived from Z[t] differs from the tracked one
+  PRUNE_LOOKAHEAD, // one of the next keystream bytes cannot be produced
+  PRUNE_SIMULATION, // the permutation is determined and does not reproduce the rest of the keystream
+  PRUNE_REASONS
+};
+
+/* Search tree statistics, indexed by keystream position t+1 (the root has t=-1) */
+struct recovery_stats
+{
+  int depths; // z_len+1
+  long *nodes; // candidates checked at each position
+  long *dead; // candidates rejected at each position
+  long pruned[PRUNE_REASONS]; // rejected candidates by reason (index 0 is unused)
+};
+
+/* Allocate zeroed statistics for a keystream of <z_len> bytes */
+static inline void recovery_stats_init(struct recovery_stats *st, int z_len)
+{
+  memset(st, 0, sizeof(*st));
+  st->depths = z_len+1;
+  st->nodes = (long *)calloc(st->depths, sizeof(long));
+  st->dead = (long *)calloc(st->depths, sizeof(long));
+}
+
+static inline void recovery_stats_free(struct recovery_stats *st)
+{
+  free(st->nodes);
+  free(st->dead);
+}
+
+/* Add the counters of <src> to <dst> (same keystream length) */
+static inline void recovery_stats_add(struct recovery_stats *dst, struct recovery_stats *src)
+{
+  int l;
+  for(l=0;l<dst->depths;l++)
+  {
+    dst->nodes[l] += src->nodes[l];
+    dst->dead[l] += src->dead[l];
+  }
+  for(l=0;l<PRUNE_REASONS;l++)
+    dst->pruned[l] += src->pruned[l];
+}
+
+static inline long recovery_stats_total(struct recovery_stats *st)
+{
+  long n = 0;
+  int l;
+  for(l=0;l<st->depths;l++)
+    n += st->nodes[l];
+  return n;
+}
+
+/* How a search ended (recovery_result.status) */
+enum recovery_status
+{
+  RECOVERY_DONE = 0, // the state was found, or the whole tree was searched
+  RECOVERY_INTERRUPTED, // stopped through p->interrupt, with a checkpoint saved
+  RECOVERY_CANCELLED, // stopped through p->cancel
+  RECOVERY_BUDGET, // stopped after p->max_nodes nodes
+  RECOVERY_BAD_CHECKPOINT, // p->checkpoint cannot be resumed, see recovery_result.error
+  RECOVERY_ERROR // the search could not run, see recovery_result.error
+};
+
+/* Recovered state; entries which are not determined by the keystream are -1 */
+struct recovery_result
+{
+  int size; // SIZE of the permutation
+  int s[MAX_SIZE];
+  int inv_s[MAX_SIZE];
+  int i;
+  int j;
+  int t;
+  long nodes; // candidates checked during the search
+  int status; // enum recovery_status
+  const char *error; // what went wrong with RECOVERY_BAD_CHECKPOINT and RECOVERY_ERROR (a constant string)
+  int checkpoint_failures; // checkpoints that could not be saved
+  int member; // portfolio: the member that found the state
+  long restarts; // portfolio: restarts of the randomized members
+};
+
+/* Called for every distinct state found in exhaustive mode (under a lock,
+ * so it is never called concurrently); return non-zero to stop the search */
+typedef int (*solution_callback)(struct recovery_result *res, void *arg);
+
+/* Called with the statistics so far when a progress report is requested */
+typedef void (*progress_callback)(struct recovery_stats *st, void *arg);
+
+/* Order in which the values of a guessed entry are tried (recovery_params.order) */
+enum value_order
+{
+  ORDER_ASCENDING = 0, // smallest free value first
+  ORDER_BIASED = 1, // the value the keystream points at, then by the RC4 key schedule bias
+  VALUE_ORDERS
+};
+
+/* Keystream that is still arriving while the search runs
+ *
+ * The producer writes the bytes to recovery_params.z, then raises <avail>
+ * and broadcasts <more> under <lock>; at the end of the input it sets
+ * <done>. The search waits only when it gets to a byte that is not there yet.
+*/
+struct keystream_feed
+{
+  pthread_mutex_t lock;
+  pthread_cond_t more; // broadcast when bytes arrive or the input ends
+  int avail; // bytes of the keystream that have arrived
+  int done; // set at the end of the input: the keystream is z[0..avail-1]
+};
+
+/* Partial knowledge of the state, e.g. from a side channel or an earlier
+ * run: the state right after keystream byte <t> was produced, t=-1 for the
+ * state before the first byte (where j is 0) */
+struct recovery_hints
+{
+  int t; // keystream position of the hints, -1 .. z_len-1
+  int j; // j at that position, -1 if unknown
+  int n; // number of known entries
+  uint8_t x[MAX_SIZE]; // S[x[l]] = v[l] for l < n
+  uint8_t v[MAX_SIZE];
+};
+
+/* What to recover and how */
+struct recovery_params
+{
+  uint8_t *z; // keystream
+  int z_len; // lenght of the keystream (its capacity with <feed>)
+  struct keystream_feed *feed; // if not NULL, the keystream arrives while the search runs (no checkpoints then)
+  int nworkers; // number of threads, 1 for the sequential search
+  int split_depth; // candidates with t below this are shared between threads
+  int lookahead; // number of future keystream bytes to check for each candidate, 0 to disable
+  int all; // if set, enumerate all consistent states instead of stopping at the first
+  solution_callback on_solution; // exhaustive mode: receives each state as it is found
+  void *arg; // passed to <on_solution>
+  struct recovery_stats *stats; // if not NULL, the statistics of the search are added here (see recovery_stats_init())
+  volatile sig_atomic_t *progress; // if not NULL, set it (e.g. from a signal handler) to get a progress report
+  progress_callback on_progress; // receives the progress report
+  void *progress_arg; // passed to <on_progress>
+  const char *checkpoint; // if not NULL, save the position of the search to this file (sequential search only)
+  int checkpoint_interval; // seconds between checkpoints
+  int resume; // continue from <checkpoint> instead of starting from scratch
+  volatile sig_atomic_t *interrupt; // if not NULL, set it (e.g. on SIGTERM) to save a checkpoint and stop
+  volatile sig_atomic_t *cancel; // if not NULL, set it (e.g. from another thread) to stop the search
+  long max_nodes; // if > 0, stop after about this many nodes (counted in steps of 1024 per thread)
+  int shard; // explore only shard <shard> of <nshards> (0 <= shard < nshards)
+  int nshards; // 1 to explore the whole tree
+  int shard_depth; // the tree is split between shards this many keystream bytes below the root
+  struct recovery_hints *hints; // if not NULL, start from this partial state instead of the beginning
+  int order; // enum value_order: which free values are guessed first (the search stays complete either way)
+  int portfolio; // if > 1, race this many solver configurations, one thread each, instead of
+                 // <nworkers> (see "Portfolio" in recovery.c; not with <all>, <checkpoint> or shards)
+  long restart_unit; // portfolio: node limit of the first run of a randomized member
+};
+
+/* Predicted cost of a search, see estimate() */
+struct recovery_estimate
+{
+  int probes; // random probes taken
+  double nodes; // estimated number of nodes of the whole search tree
+  double low; // 95% confidence interval of <nodes>
+  double high;
+  double nodes_per_sec; // measured speed of the backtracking on this keystream
+  double seconds; // nodes / nodes_per_sec: time of an exhaustive search on one thread
+  int status; // RECOVERY_DONE, or RECOVERY_ERROR if the estimate could not be made
+  const char *error; // what went wrong with RECOVERY_ERROR (a constant string)
+};
+
+/* State recovery for one word size */
+struct recovery_kernels
+{
+  int alpha;
+  long (*solve)(struct recovery_params *p, struct recovery_result *res); // recover()
+  int (*estimate)(struct recovery_params *p, int probes, struct recovery_estimate *est); // estimate()
+};
+
+extern const struct recovery_kernels recovery_kernels_a3;
+extern const struct recovery_kernels recovery_kernels_a4;
+extern const struct recovery_kernels recovery_kernels_a5;
+extern const struct recovery_kernels recovery_kernels_a6;
+extern const struct recovery_kernels recovery_kernels_a7;
+extern const struct recovery_kernels recovery_kernels_a8;
+
+/* Get state recovery for word size <alpha>, NULL if it is not supported
+*/
+static inline const struct recovery_kernels *recovery_select(int alpha)
+{
+  switch(alpha)
+  {
+    case 3: return &recovery_kernels_a3;
+    case 4: return &recovery_kernels_a4;
+    case 5: return &recovery_kernels_a5;
+    case 6: return &recovery_kernels_a6;
+    case 7: return &recovery_kernels_a7;
+    case 8: return &recovery_kernels_a8;
+  }
+  return NULL;
+}
+
+#ifdef ALPHA
+/* Backtracking kernels, compiled once per word size */
+
+// Bitsets over permutation indices/values
+#define WORDS      ((SIZE+63)/64)
+#define KNOWN(c,x) (((c)->known[(x)>>6] >> ((x)&63)) & 1)   // is S[x] known?
+#define USED(c,v)  (!(((c)->unused[(v)>>6] >> ((v)&63)) & 1)) // does <v> appear in S?
+
+/* Data types */
+
+struct candidate_struct
+{
+  uint8_t s[SIZE]; // Current permutation; S[x] is valid if KNOWN(c,x)
+  uint8_t inv_s[SIZE]; // Inverse permutation; S^-1[v] is valid if USED(c,v)
+  uint64_t known[WORDS]; // bit x is set if S[x] is known
+  uint64_t unused[WORDS]; // bit v is set if <v> does not appear in S yet
+  int guessed_si;
+  int guessed_sj;
+  int j; // counter j in RC4
+  int i; // counter i in RC4
+  int t; // keystream position
+  int start; // t of the root this candidate comes from, -1 unless it is a hinted root at t >= 0
+  uint64_t path; // hash of the guesses from the root to this candidate (see path_mix())
+#ifdef CONFLICT_STATS
+  // Conflict sets (see bt_loop() in recovery.c); bit d stands for the guesses of the frame at depth d
+  uint64_t dep[SIZE]; // guesses S[x] was derived from, if KNOWN(c,x) (without dep_j)
+  uint64_t dep_j; // guesses j was derived from; they moved the entries, so every entry depends on them
+  uint64_t why; // guesses the entries set by the next assign() are derived from
+  uint64_t conflict; // guesses the last contradiction found in the candidate rests on
+#endif
+};
+
+typedef struct candidate_struct candidate;
+
+/* One change of a candidate's permutation, kept on the undo trail */
+struct undo_struct
+{
+  uint8_t x; // position that was assigned (or the first swapped position)
+  uint8_t y; // second swapped position, equal to <x> if <x> was assigned
+};
+
+typedef struct undo_struct undo;
+
+/* Changes made to a candidate in place, newest last */
+struct trail_struct
+{
+  undo *entries;
+  int top;
+};
+
+typedef struct trail_struct trail;
+
+/* Primitives on a candidate's bitsets and permutation: they run at every
+ * node of the search, so they are inlined into the kernels */
+
+/* Make a guess of an entry in the candidate's current permutation
+ *
+ * The guessed entry should not already be present in the permutation,
+ * i.e. it is the first set bit of the <unused> bitset starting at <start>
+ *
+ * @param c candidate for which to guess entries
+ * @param start The guessed value will be bigger than or equal to <start>
+ * @return guess Newly guessed value, -1 if there are no unused values left
+*/
+static inline int guess_entry(candidate *c, int start)
+{
+  if(start >= SIZE)
+    return -1;
+  int w = start>>6;
+  uint64_t m = c->unused[w] & (~0ULL << (start&63));
+  while(m == 0)
+  {
+    if(++w == WORDS)
+      return -1;
+    m = c->unused[w];
+  }
+  return (w<<6) + __builtin_ctzll(m);
+}
+
+/* Set an unknown entry of the permutation and remember it on the trail
+ *
+ * @param c Candidate to modify
+ * @param tr Trail of the candidate
+ * @param x Index of the entry (S[x] must be unknown)
+ * @param v New value (must not be present in the permutation)
+ * @return void
+*/
+static inline void assign(candidate *c, trail *tr, int x, int v)
+{
+  c->s[x] = v;
+  c->inv_s[v] = x;
+  c->known[x>>6] |= 1ULL << (x&63);
+  c->unused[v>>6] &= ~(1ULL << (v&63));
+#ifdef CONFLICT_STATS
+  c->dep[x] = c->why;
+#endif
+  tr->entries[tr->top].x = x;
+  tr->entries[tr->top].y = x;
+  tr->top++;
+}
+
+/* Swap two known entries of the permutation and remember it on the trail
+ *
+ * @param c Candidate to modify
+ * @param tr Trail of the candidate
+ * @param x Index of the first entry
+ * @param y Index of the second entry
+ * @return void
+*/
+static inline void swap(candidate *c, trail *tr, int x, int y)
+{
+  int a = c->s[x];
+  int b = c->s[y];
+  if(x == y)
+    return;
+  c->s[x] = b;
+  c->s[y] = a;
+  c->inv_s[b] = x;
+  c->inv_s[a] = y;
+#ifdef CONFLICT_STATS
+  uint64_t d = c->dep[x];
+  c->dep[x] = c->dep[y];
+  c->dep[y] = d;
+#endif
+  tr->entries[tr->top].x = x;
+  tr->entries[tr->top].y = y;
+  tr->top++;
+}
+
+/* Undo the changes made to the permutation since the trail had <mark> entries
+ *
+ * @param c Candidate to roll back
+ * @param tr Trail of the candidate
+ * @param mark Trail position to go back to
+ * @return void
+*/
+static inline void rollback(candidate *c, trail *tr, int mark)
+{
+  while(tr->top > mark)
+  {
+    undo *u = &tr->entries[--tr->top];
+    if(u->y == u->x)
+    {
+      int v = c->s[u->x];
+      c->known[u->x>>6] &= ~(1ULL << (u->x&63));
+      c->unused[v>>6] |= 1ULL << (v&63);
+    }
+    else
+    {
+      int a = c->s[u->x];
+      int b = c->s[u->y];
+      c->s[u->x] = b;
+      c->s[u->y] = a;
+      c->inv_s[b] = u->x;
+      c->inv_s[a] = u->y;
+#ifdef CONFLICT_STATS
+      uint64_t d = c->dep[u->x];
+      c->dep[u->x] = c->dep[u->y];
+      c->dep[u->y] = d;
+#endif
+    }
+  }
+}
+
+/* How the values of guessed entries are ranked (see "Value ordering" in recovery.c) */
+struct ordering_struct
+{
+  int policy; // enum value_order, or ORDER_RANDOM
+  uint8_t *z; // keystream the guesses are steered by
+  uint8_t *values; // ORDER_RANDOM: values[x*SIZE+r] is the value of rank r for S[x]
+};
+
+// Policy of the randomized portfolio members: a seeded shuffle of the values of every entry
+#define ORDER_RANDOM (VALUE_ORDERS)
+
+typedef struct ordering_struct ordering;
+
+/* One level of the search tree: the parent candidate's counters
+ * (its permutation is restored from the trail) and the guesses of
+ * the last child derived from it with first()/next()
+*/
+struct frame_struct
+{
+  int i;
+  int j;
+  int t;
+  int mark; // trail position of the parent candidate
+  int guessed_si;
+  int guessed_sj;
+  int si_start; // arguments of the step() which derived the last child
+  int sj_start;
+  int is_first; // set if the last child came from first()
+  uint64_t path; // of the parent candidate
+#ifdef CONFLICT_STATS
+  uint64_t dep_j; // of the parent candidate
+  uint64_t conflict; // guesses above this frame the dead children so far rest on
+#endif
+};
+
+typedef struct frame_struct frame;
+
+/* Per-thread memory of the backtracker */
+struct workspace_struct
+{
+  candidate c; // the only candidate, modified in place
+  trail tr;
+  int avail; // keystream bytes known to have arrived (see keystream_len())
+  const ordering *ord; // value ordering of this thread's guesses, NULL for ascending
+  long budget; // nodes left before bt() gives up, -1 for no limit
+  long polled; // nodes this thread has checked for a stop request
+  int member; // portfolio member running on this workspace, 0 otherwise
+  frame *frames; // one per keystream byte
+  struct recovery_stats stats; // of this thread
+#ifdef CONFLICT_STATS
+  int jumped_to; // depth of the frame backjumping would go on with, while the frames below it still run
+  long skipped; // nodes backjumping would not have visited
+#endif
+};
+
+typedef struct workspace_struct workspace;
+
+/* Final state of a solution, as compared for dropping duplicates */
+struct solution_key_struct
+{
+  uint8_t s[SIZE]; // unknown entries are 0
+  uint64_t known[WORDS];
+  int j;
+};
+
+typedef struct solution_key_struct solution_key;
+
+/* Open addressing hash set of the solutions reported so far */
+struct solution_set_struct
+{
+  solution_key *keys;
+  uint8_t *used; // used[l] is set if keys[l] holds a solution
+  long cap; // power of two
+  long count;
+};
+
+typedef struct solution_set_struct solution_set;
+
+/* State shared by everybody working on one keystream */
+struct search_struct
+{
+  uint8_t *z; // keystream
+  int z_len; // lenght of the keystream
+  atomic_int stop; // set as soon as somebody reaches the end of the keystream
+  pthread_mutex_t lock; // protects <solution> and <found>
+  candidate solution; // the first candidate which survived the whole keystream
+  struct recovery_params *p; // options of the search
+  solution_set found; // exhaustive mode: distinct solutions so far
+  struct recovery_stats total; // statistics of the threads that are done
+  struct recovery_stats **live; // statistics of the running threads (read without locking)
+  int nlive;
+  ordering order; // value ordering of the guesses
+  const ordering *ord; // &order, or NULL for ORDER_ASCENDING
+  int root_index; // index of the root being searched (sequential search)
+  time_t saved; // when the last checkpoint was saved
+  int halted; // stopped without a solution, see halt()
+  int status; // enum recovery_status
+  const char *error; // with RECOVERY_BAD_CHECKPOINT and RECOVERY_ERROR
+  int save_failures; // checkpoints that could not be saved
+  atomic_long spent; // nodes counted against p->max_nodes
+  int winner; // portfolio member that found <solution>
+};
+
+typedef struct search_struct search;
+
+#define get_s                 ALPHA_NAME(get_s)
+#define get_inv_s             ALPHA_NAME(get_inv_s)
+#define debug_print_candidate ALPHA_NAME(debug_print_candidate)
+#define sanity_check          ALPHA_NAME(sanity_check)
+#define step                  ALPHA_NAME(step)
+#define first                 ALPHA_NAME(first)
+#define next                  ALPHA_NAME(next)
+#define root                  ALPHA_NAME(root)
+#define update_state          ALPHA_NAME(update_state)
+#define forward_check         ALPHA_NAME(forward_check)
+#define bt                    ALPHA_NAME(bt)
+#define workspace_init        ALPHA_NAME(workspace_init)
+#define workspace_free        ALPHA_NAME(workspace_free)
+#define recover               ALPHA_NAME(recover)
+#define estimate              ALPHA_NAME(estimate)
+
+int get_s(candidate *c, int x);
+int get_inv_s(candidate *c, int v);
+void debug_print_candidate(candidate *c);
+int sanity_check(candidate *c);
+int step(candidate *c, trail *tr, int si_start, int sj_start);
+int first(candidate *c, frame *f, trail *tr, const ordering *ord);
+int next(candidate *c, frame *f, trail *tr, const ordering *ord);
+candidate root();
+int update_state(candidate *c, trail *tr, uint8_t *z);
+int forward_check(candidate *c, trail *tr, uint8_t *z, int z_len, int k);
+int bt(candidate *c, workspace *ws, search *sr);
+int workspace_init(workspace *ws, int z_len);
+void workspace_free(workspace *ws);
+long recover(struct recovery_params *p, struct recovery_result *res);
+int estimate(struct recovery_params *p, int probes, struct recovery_estimate *est);
+#endif // ALPHA
+
+#endif // __RECOVERY_H__
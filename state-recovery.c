@@ -1,610 +1,1428 @@
 #include <stdint.h>
 #include <stdlib.h>
-#include <alloca.h>
 #include <stdio.h>
 #include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "util.h" // convert from hex to binary
 #include "rc4prga.h"
+#include "recovery.h"
+#include "keysearch.h"
 
-#ifdef DEBUG
-# define DEBUG_PRINT(x) printf x
-#else
-//# define DEBUG_PRINT(x) do {} while (0)
-# define DEBUG_PRINT(x)
+#ifndef DEFAULT_ALPHA
+  #define DEFAULT_ALPHA (4)
 #endif
 
-/* Data types */
-
-struct candidate_struct
-{
-  int s[SIZE]; // Current permutation; changes each step
-  int inv_s[SIZE]; // Inverse permutation; changes each step
-  int guessed[SIZE]; // contains guessed indices and their values
-  int guessed_si;
-  int guessed_sj;
-  int nguessed; // Number of guessed values (i.e. number of set elements in guessed
-  int j; // counter j in RC4
-  int i; // counter i in RC4
-  int idx; // index in the permutation <s> the value of which we are guessing
-           // If it is 0, then we are working with index j.
-  int t; // keystream position
-};
-
-typedef struct candidate_struct candidate;
-
-/* Forward declarations */
-
-int bt(candidate c, uint8_t *z, int z_len);
-void print_candidate(candidate *c);
-void debug_print_candidate(candidate *c);
+#define DEFAULT_CHECKPOINT_INTERVAL (60)
+// Keystream bytes kept with --incremental, unless --max-len says otherwise
+#define DEFAULT_MAX_LEN (1<<16)
+// Longest keystream of a --batch job, longer ones are rejected before anything is allocated
+#define MAX_JOB_LEN (1<<16)
 
-/* Function definitions */
-
-/* Print candidate_struct fields
+/* Print recovered state
  *
  * Print partially filled permutation and inverse permutation
  *
- * @param c Struct to print
+ * @param res State to print
  * @return void
 */
-void print_candidate(candidate *c)
+void print_result(struct recovery_result *res)
 {
   int l = 0;
 
   printf("Permuation:\n");
-  for(l=0;l<SIZE;l++)
+  for(l=0;l<res->size;l++)
     printf("% 3d ", l);
   printf("\n");
-  for(l=0;l<SIZE;l++)
-    printf("% 3d ", c->s[l]);
+  for(l=0;l<res->size;l++)
+    printf("% 3d ", res->s[l]);
 
   printf("\n");
 
   printf("Reverse permuation:\n");
-  for(l=0;l<SIZE;l++)
+  for(l=0;l<res->size;l++)
     printf("% 3d ", l);
   printf("\n");
-  for(l=0;l<SIZE;l++)
-    printf("% 3d ", c->inv_s[l]);
+  for(l=0;l<res->size;l++)
+    printf("% 3d ", res->inv_s[l]);
 
   printf("\n");
-  printf("t=%d; i=%d; j=%d\n", c->t, c->i, c->j);
+  printf("t=%d; i=%d; j=%d\n", res->t, res->i, res->j);
   return;
 }
 
-/* Print candidate_struct fields in DEBUG mode
- *
- * Print partially filled permutation and inverse permutation
- * only if -DDEBUG was set during the compilation time
+/* Print the fields of a recovered state in JSON (without the braces) */
+void print_json_fields(FILE *out, struct recovery_result *res)
+{
+  int l;
+
+  fprintf(out, "\"t\":%d,\"i\":%d,\"j\":%d,\"s\":[", res->t, res->i, res->j);
+  for(l=0;l<res->size;l++)
+    fprintf(out, l ? ",%d" : "%d", res->s[l]);
+  fprintf(out, "]");
+}
+
+/* Print recovered state as one JSON line, unknown entries are -1
  *
- * @param c Struct to print
- * @return void
+ * Used as the solution callback in exhaustive mode
 */
-void debug_print_candidate(candidate *c)
+int print_json(struct recovery_result *res, void *arg)
 {
-  int l = 0;
+  FILE *out = (FILE *)arg;
 
-  DEBUG_PRINT(("Permuation:\n"));
-  for(l=0;l<SIZE;l++)
-    DEBUG_PRINT(("% 3d ", l));
-  DEBUG_PRINT(("\n"));
-  for(l=0;l<SIZE;l++)
-    DEBUG_PRINT(("% 3d ", c->s[l]));
-
-  DEBUG_PRINT(("\n"));
+  fprintf(out, "{");
+  print_json_fields(out, res);
+  fprintf(out, "}\n");
+  fflush(out);
+  return 0;
+}
 
-  DEBUG_PRINT(("Reverse permuation:\n"));
-  for(l=0;l<SIZE;l++)
-    DEBUG_PRINT(("% 3d ", l));
-  DEBUG_PRINT(("\n"));
-  for(l=0;l<SIZE;l++)
-    DEBUG_PRINT(("% 3d ", c->inv_s[l]));
+// Set by SIGUSR1, the search reports its statistics and clears it
+static volatile sig_atomic_t progress_requested = 0;
 
-  DEBUG_PRINT(("\n"));
-  DEBUG_PRINT(("t=%d; i=%d; j=%d\n", c->t, c->i, c->j));
-  return;
+void on_sigusr1(int sig)
+{
+  progress_requested = 1;
 }
 
+// Set by SIGINT/SIGTERM with --checkpoint, the search saves a checkpoint and stops
+static volatile sig_atomic_t interrupt_requested = 0;
 
-/* Check if the candidate's permutation does not have dublicates
+void on_interrupt(int sig)
+{
+  interrupt_requested = 1;
+}
+
+/* Print search statistics to <arg> (a FILE*)
  *
- * @param c Candidate to check
- * @return void
+ * Nodes and dead candidates per keystream position, the branching factor
+ * (children per surviving candidate) and what killed the dead ones.
+ * Used on exit (--stats) and as the progress callback on SIGUSR1.
 */
-void sanity_check(candidate *c)
+void print_stats(struct recovery_stats *st, void *arg)
 {
-  //Extra array needed
-  int *s = c->s;
-  int numbers[SIZE];
+  static const char *reasons[PRUNE_REASONS] = { "",
+    "occupied s[idx]", "duplicate inv_s[zt]", "conflicting S[j]",
+    "conflicting S[i]", "j mismatch", "lookahead", "simulation" };
+  FILE *out = (FILE *)arg;
   int l;
 
-  for(l=0;l<SIZE;l++)
-    numbers[l] = 0;
-
-  for(l=0;l<SIZE;l++)
+  fprintf(out, "Search statistics: %ld nodes\n", recovery_stats_total(st));
+  fprintf(out, "%6s %12s %12s %10s\n", "t", "nodes", "dead", "branching");
+  for(l=0;l<st->depths;l++)
   {
-    if(s[l] == -1)
+    if(st->nodes[l] == 0)
       continue;
-    //Check if that number is already present
-    if((numbers[s[l]] == 0) )
-      numbers[s[l]]++;
-    else
+    fprintf(out, "%6d %12ld %12ld", l-1, st->nodes[l], st->dead[l]);
+    long alive = st->nodes[l] - st->dead[l];
+    if(l+1 < st->depths && alive > 0)
+      fprintf(out, " %10.2f", (double)st->nodes[l+1]/alive);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "Pruned:");
+  for(l=1;l<PRUNE_REASONS;l++)
+    fprintf(out, "%s %s %ld", l > 1 ? "," : "", reasons[l], st->pruned[l]);
+  fprintf(out, "\n");
+  fflush(out);
+}
+
+/* States found by this process, kept for the shard file */
+struct state_list
+{
+  struct recovery_result *states;
+  long count;
+  long cap;
+};
+
+void state_list_add(struct state_list *l, struct recovery_result *res)
+{
+  if(l->count == l->cap)
+  {
+    l->cap = l->cap ? 2*l->cap : 16;
+    l->states = (struct recovery_result *)realloc(l->states, l->cap*sizeof(*res));
+    if(l->states == NULL)
     {
-      //Duplicate found
-      DEBUG_PRINT(("sanity_check(): Dublicate found: %d (%d times)",s[l], numbers[s[l]]));
-#ifdef DEBUG
-      debug_print_candidate(c);
-#endif
-      getchar();
+      printf("Out of memory\n");
+      exit(-1);
     }
   }
-  return; 
+  l->states[l->count++] = *res;
 }
 
-/* Make a guess of an entry in the candidate's current permutation
- *
- * The guessed entry should not already be present in the permutation
- *
- * @param c candidate for which to guess entries
- * @param start The guessed value will be bigger than <start>
- * @return guess Newly guessed value
+/* Solution callback of a shard in exhaustive mode: print the state as a
+ * JSON line and keep it for the shard file
 */
-int guess_entry(candidate *c, int start)
+int collect_json(struct recovery_result *res, void *arg)
 {
-  int guess = start;
-  while(c->inv_s[guess] != -1 && guess < SIZE)
-    guess++;
-  if(guess >= SIZE)
-    return -1;
-  return guess;
+  state_list_add((struct state_list *)arg, res);
+  return print_json(res, stdout);
 }
 
-/* Try to make a RC4 step for the candidate (i.e. update the permutation)
+/* Shard files
+ *
+ * A shard (--shard K/N) writes what it found and its statistics to a
+ * text file (--shard-out), --merge combines the files of all shards:
  *
- * If the necessary entries in the permutation are not
- * defined, guess them. First guess S[i] (if neceseary) and
- * then guess S[j] (if necessary)
+ *   rc4-state-recovery-shard 2
+ *   alpha 4
+ *   keystream <hex>
+ *   shard <K> <N> <depth>
+ *   all <0|1>
+ *   complete <0|1>                  (0 if the shard was interrupted)
+ *   nodes <count per depth>
+ *   dead <count per depth>
+ *   pruned <count per prune_reason>
+ *   states <count>
+ *   state <t> <i> <j> <S[0]> ... (unknown entries are -1)
+*/
+
+#define SHARD_MAGIC "rc4-state-recovery-shard"
+#define SHARD_VERSION (2)
+
+/* One shard file as read by read_shard() */
+struct shard_file
+{
+  int alpha;
+  char *keystream; // hex
+  int shard;
+  int nshards;
+  int depth;
+  int all;
+  int complete;
+  struct recovery_stats stats;
+  struct state_list found;
+};
+
+/* Write the results of a shard
  *
- * @param c Candidate for which to make an RC4 step
- * @param si_start The guessed value for S[i] should be larger than <si_start>
- * @param sj_start The guessed value for S[j] should be larger than <sj_start>
- * @return  0 Successfully guessed both values (everything is alright)
- *         -1 Could not guess value for S[i] (for the curren value of <si_start>)
- *         -2 Could not guess value for S[j] (for the curren value of <sj_start>)
- *            and S[i] can be re-guessed
- *         -3 Could not guess value for S[j] (for the curren value of <sj_start>)
- *            and S[i] cannot be re-guessed (it was already set in previous steps)
- *         -4 Neither S[i] nor S[j] were guessed (they already were set in the permutation
- *            in the previous steps) (everything is alright)
- *	   -5 S[i] was guessed successfully, but S[j] could not be guessed
+ * @return 0 on success, -1 if the file could not be written
 */
-int step(candidate *c, int si_start, int sj_start)
+int write_shard(const char *name, int alpha, char *keystream, struct recovery_params *p, int complete,
+                struct recovery_stats *st, struct state_list *found)
 {
- 
-  int is_si_guessed = 0;
-  int is_sj_guessed = 0;
-   
-  DEBUG_PRINT(("step(): starting step\n"));
-  
-  DEBUG_PRINT(("Updating i: %d -> ",c->i));
-  c->i = ind(c->i+1); 
-  DEBUG_PRINT(("%d\n",c->i));
+  FILE *f = fopen(name, "w");
+  long l;
+  int x;
 
-  if (c->j == -1) // If we lost track of <j>
+  if(f == NULL)
+    return -1;
+  fprintf(f, "%s %d\n", SHARD_MAGIC, SHARD_VERSION);
+  fprintf(f, "alpha %d\nkeystream %s\n", alpha, keystream);
+  fprintf(f, "shard %d %d %d\nall %d\ncomplete %d\n", p->shard, p->nshards, p->shard_depth, p->all, complete);
+  fprintf(f, "nodes");
+  for(x=0;x<st->depths;x++)
+    fprintf(f, " %ld", st->nodes[x]);
+  fprintf(f, "\ndead");
+  for(x=0;x<st->depths;x++)
+    fprintf(f, " %ld", st->dead[x]);
+  fprintf(f, "\npruned");
+  for(x=1;x<PRUNE_REASONS;x++)
+    fprintf(f, " %ld", st->pruned[x]);
+  fprintf(f, "\nstates %ld\n", found->count);
+  for(l=0;l<found->count;l++)
   {
-    printf("Bug: we lost track of j\n");
-    exit(-1);
+    struct recovery_result *r = &found->states[l];
+    fprintf(f, "state %d %d %d", r->t, r->i, r->j);
+    for(x=0;x<r->size;x++)
+      fprintf(f, " %d", r->s[x]);
+    fprintf(f, "\n");
   }
+  int err = ferror(f);
+  if(fclose(f) != 0 || err)
+    return -1;
+  return 0;
+}
 
-  // Guess s[i] if needed
-  if (c->s[c->i] == -1)
+static void shard_error(const char *name, const char *what)
+{
+  fprintf(stderr, "Cannot merge %s: %s\n", name, what);
+  exit(-1);
+}
+
+/* Read a shard file written by write_shard(), exits on errors
+*/
+void read_shard(const char *name, struct shard_file *sf)
+{
+  char magic[64];
+  int version, x, v;
+  size_t n = 0;
+  long l, count;
+
+  FILE *f = fopen(name, "r");
+  if(f == NULL)
+    shard_error(name, "cannot open the file");
+  memset(sf, 0, sizeof(*sf));
+  if(fscanf(f, "%63s %d", magic, &version) != 2 || strcmp(magic, SHARD_MAGIC) != 0 || version != SHARD_VERSION)
+    shard_error(name, "not a shard file");
+  if(fscanf(f, " alpha %d keystream ", &sf->alpha) != 1 || rc4_select(sf->alpha) == NULL)
+    shard_error(name, "corrupted header");
+  if(getline(&sf->keystream, &n, f) < 0)
+    shard_error(name, "corrupted header");
+  sf->keystream[strcspn(sf->keystream, "\n")] = 0;
+  if(fscanf(f, " shard %d %d %d all %d complete %d", &sf->shard, &sf->nshards, &sf->depth, &sf->all, &sf->complete) != 5)
+    shard_error(name, "corrupted header");
+  recovery_stats_init(&sf->stats, strlen(sf->keystream)/2);
+  if(fscanf(f, " nodes") != 0)
+    shard_error(name, "corrupted statistics");
+  for(x=0;x<sf->stats.depths;x++)
+    if(fscanf(f, "%ld", &sf->stats.nodes[x]) != 1)
+      shard_error(name, "corrupted statistics");
+  if(fscanf(f, " dead") != 0)
+    shard_error(name, "corrupted statistics");
+  for(x=0;x<sf->stats.depths;x++)
+    if(fscanf(f, "%ld", &sf->stats.dead[x]) != 1)
+      shard_error(name, "corrupted statistics");
+  if(fscanf(f, " pruned") != 0)
+    shard_error(name, "corrupted statistics");
+  for(x=1;x<PRUNE_REASONS;x++)
+    if(fscanf(f, "%ld", &sf->stats.pruned[x]) != 1)
+      shard_error(name, "corrupted statistics");
+  if(fscanf(f, " states %ld", &count) != 1)
+    shard_error(name, "corrupted states");
+  for(l=0;l<count;l++)
   {
-    int entry  = guess_entry(c, si_start);
-    if (entry == -1)
+    struct recovery_result r;
+    memset(&r, 0, sizeof(r));
+    r.size = 1<<sf->alpha;
+    for(x=0;x<r.size;x++)
+      r.inv_s[x] = -1;
+    if(fscanf(f, " state %d %d %d", &r.t, &r.i, &r.j) != 3)
+      shard_error(name, "corrupted states");
+    for(x=0;x<r.size;x++)
     {
-      DEBUG_PRINT(("WARNING: cannot guees a value for S[i], current value is %d\n", c->s[c->i]));
-      return -1;
+      if(fscanf(f, "%d", &v) != 1 || v < -1 || v >= r.size)
+        shard_error(name, "corrupted states");
+      r.s[x] = v;
+      if(v >= 0)
+        r.inv_s[v] = x;
     }
-    c->s[c->i] = entry;
-    c->guessed_si = c->s[c->i];
-    is_si_guessed = 1;
-    DEBUG_PRINT(("step(): Guessing S[%d] = %d\n", c->i,c->s[c->i]));
-  } else
-  {
-    DEBUG_PRINT(("step(): No guessing: S[%d]=%d is known\n", c->i,c->s[c->i]));
+    state_list_add(&sf->found, &r);
   }
+  fclose(f);
+}
 
-  DEBUG_PRINT(("Updating j: %d -> ",c->j));
-  c->j = ind(c->j+c->s[c->i]);
-  DEBUG_PRINT(("%d\n",c->j));
+/* Order of states for dropping duplicates */
+int cmp_state(const void *a, const void *b)
+{
+  const struct recovery_result *x = (const struct recovery_result *)a;
+  const struct recovery_result *y = (const struct recovery_result *)b;
+  if(x->t != y->t)
+    return x->t - y->t;
+  if(x->j != y->j)
+    return x->j - y->j;
+  return memcmp(x->s, y->s, x->size*sizeof(x->s[0]));
+}
 
-  int tmp = c->inv_s[c->s[c->i]];
-  c->inv_s[c->s[c->i]] = c->i;
+/* Combine the shard files <names> and print the result like a single run
+ *
+ * @return 0 if all shards are there and complete, 1 otherwise
+*/
+int merge_shards(char **names, int count, int show_stats)
+{
+  struct shard_file *sf = (struct shard_file *)calloc(count, sizeof(*sf));
+  struct state_list all;
+  int ret = 0;
+  long l, n;
+  int f;
 
-  // Guess s[j] if needed
-  if (c->s[c->j] == -1)
+  memset(&all, 0, sizeof(all));
+  for(f=0;f<count;f++)
   {
-    c->s[c->j] = guess_entry(c, sj_start);
-    c->guessed_sj = c->s[c->j];
-    is_sj_guessed = 1;
-    if (c->s[c->j] == -1 && (is_si_guessed == 1 ))
+    read_shard(names[f], &sf[f]);
+    if(sf[f].alpha != sf[0].alpha || strcmp(sf[f].keystream, sf[0].keystream) != 0 ||
+       sf[f].nshards != sf[0].nshards || sf[f].depth != sf[0].depth || sf[f].all != sf[0].all)
+      shard_error(names[f], "comes from a different run");
+    for(l=0;l<f;l++)
+      if(sf[l].shard == sf[f].shard)
+        shard_error(names[f], "shard given twice");
+    if(!sf[f].complete)
     {
-      DEBUG_PRINT(("step(): WARNING: cannot guees a value for S[j] (will try to increase s[i])\n"));
-      return -2;
-    }
-    if (c->s[c->j] == -1 && (is_si_guessed == 0 ))
-    {
-      DEBUG_PRINT(("step(): WARNING: cannot guees a value for S[j] (an s[i] is fixed)\n"));
-      return -3;
+      fprintf(stderr, "Warning: shard %d/%d (%s) did not complete\n", sf[f].shard, sf[f].nshards, names[f]);
+      ret = 1;
     }
-    DEBUG_PRINT(("step(): Guessing S[%d] = %d\n", c->j,c->s[c->j]));
-  } else
+    if(f > 0)
+      recovery_stats_add(&sf[0].stats, &sf[f].stats);
+    for(l=0;l<sf[f].found.count;l++)
+      state_list_add(&all, &sf[f].found.states[l]);
+  }
+  if(count < sf[0].nshards)
   {
-    DEBUG_PRINT(("step(): No guessing: S[%d]=%d is known\n", c->j,c->s[c->j]));
+    fprintf(stderr, "Warning: %d of %d shards are missing\n", sf[0].nshards-count, sf[0].nshards);
+    ret = 1;
   }
 
-  c->inv_s[c->s[c->i]] = tmp;
-
-  DEBUG_PRINT(("step(): swapping positions s[%d]=%d and s[%d]=%d\n", c->i,c->s[c->i],c->j,c->s[c->j]));
-  int temp = c->s[c->j]; // can be undefined, i.e. -1
-  c->s[c->j] = c->s[c->i];
-  c->s[c->i] = temp; 
+  qsort(all.states, all.count, sizeof(*all.states), cmp_state);
+  for(l=0,n=0;l<all.count;l++)
+    if(n == 0 || cmp_state(&all.states[n-1], &all.states[l]) != 0)
+      all.states[n++] = all.states[l];
+  all.count = n;
 
-  DEBUG_PRINT(("step(): step completed\n"));
-  if( (is_si_guessed == 0) && (is_sj_guessed == 0) ) // if no guessing was made
+  if(sf[0].all)
   {
-    DEBUG_PRINT(("step(): No guessing at all\n"));
-    return -4;
+    for(l=0;l<all.count;l++)
+      print_json(&all.states[l], stdout);
+    fprintf(stderr, "Found %ld distinct states consistent with the keystream\n", all.count);
   }
-
-  if( (is_si_guessed == 1) && (is_sj_guessed == 0) ) // if s[i] was guessed but s[j] was not
+  else if(all.count > 0)
   {
-    DEBUG_PRINT(("step(): S[i] was guessed but s[j] was not\n"));
-    return -5;
+    printf(" ** Success (t=%d) Press any key ** \n", all.states[0].t);
+    print_result(&all.states[0]);
   }
-  return 0;
+  else
+    printf("No shard found a state\n");
+  if(show_stats)
+    print_stats(&sf[0].stats, stderr);
+  return ret;
 }
 
-
-/* Update reverse permutation for current indices i and j
+/* Batch mode
  *
- * @param c Candidate to update
- * @return void
+ * Keystreams are read from a file (or stdin), one job each: hex lines
+ * (empty lines and lines starting with '#' are skipped), or with --binary
+ * records of a 4 byte little endian length followed by the keystream bytes.
+ * Worker threads take the next job from the input, run the sequential
+ * search and print one JSON record per job as soon as it is done:
+ *
+ *   {"job":0,"len":40,"found":1,"ms":12.345,"nodes":1234,"t":39,...,"s":[...]}
+ *
+ * "job" is the position of the keystream in the input, with -a "found" is
+ * the number of consistent states. Bad input gives {"job":N,"error":"..."}.
 */
-void finalize_step(candidate *c)
+
+struct batch_struct
 {
-  int *s = c->s; 
-  int i = c->i; 
-  int j = c->j; 
-  c->inv_s[s[i]] = i;
-  c->inv_s[s[j]] = j;
-  return;
-}
+  FILE *in;
+  int binary; // length prefixed binary records instead of hex lines
+  int size; // keystream values must be below this
+  pthread_mutex_t in_lock; // protects <in>, <next_job> and <failed>
+  long next_job;
+  int failed; // no more jobs are read (not all threads could be started)
+  pthread_mutex_t out_lock; // protects stdout and the counters below
+  long done;
+  long solved;
+  const struct recovery_kernels *k;
+  struct recovery_params p; // options of every job
+};
 
+typedef struct batch_struct batch;
 
-/* Get the first candidate for backtracking
- * 
- * Makes a copy of candidate <c>, invokes RC4 step and returns with
- * a code which describes if the guesses durint the step went OK
+/* Read the next keystream from the batch input (under b->in_lock)
  *
- * @param c Candidate from which to derive the one for recursion
- * @param z Keystream
- * @param ret Return code (we need it because we also need to return the new candidate)
- * @param s First candidate for backtracking
+ * @param b Batch
+ * @param z The keystream goes here, free() it
+ * @param z_len Its length goes here
+ * @return 1 if a job was read, 0 at the end of the input, -1 if the job is
+ *         malformed, -2 if it is longer than MAX_JOB_LEN (<z> is NULL then
+ *         and the input goes on with the next one)
 */
-candidate first(candidate c, uint8_t *z, int *ret)
+int read_job(batch *b, uint8_t **z, int *z_len)
 {
-  candidate s = c;
-  int res = step(&s,0,0); // Make a step and guess permutation entries if necessary
-
-  if(res == -1) // cannot guess s[i], end
-    *ret = 1; // stop candidates cycle
-
- // if(res == -4) // no guessing is happenning at all (and corresponding s[i] and s[j] value were already considered in the first() function), end
- //   *ret = 1;
-
-  if(res == -3) // cannot guess s[j], and cannot re-guess s[i] (it is fixed), end
-    *ret = 1; // stop candidates cycle
-
-
-  if(res == -2) // cannot guess s[j], but can re-guess s[i]
-                // In this case we did not really assign any new values, so we should no go
-		// deeper into recursion (nor update inverse permutation)
-		// for this case; at the same time we should not interrupt
-		// the current level of recursion
+  *z = NULL;
+  if(b->binary)
   {
-    s.guessed_si++;// = 1;
-    s.guessed_sj = -1;
-    *ret = 2; // skip current candidate in the candidate cycle, and to next
+    uint8_t len[4];
+    size_t got = fread(len, 1, 4, b->in);
+    if(got == 0)
+      return 0;
+    if(got != 4)
+      return -1;
+    uint32_t n = len[0] | (len[1] << 8) | (len[2] << 16) | ((uint32_t)len[3] << 24);
+    if(n > MAX_JOB_LEN)
+    {
+      uint8_t skip[4096];
+      while(n > 0 && (got = fread(skip, 1, n < sizeof(skip) ? n : sizeof(skip), b->in)) > 0)
+        n -= got;
+      return -2;
+    }
+    *z_len = n;
+    *z = (uint8_t *)malloc(*z_len > 0 ? *z_len : 1);
+    if(*z == NULL || *z_len == 0 || fread(*z, 1, *z_len, b->in) != (size_t)*z_len)
+    {
+      free(*z);
+      *z = NULL;
+      return -1;
+    }
+    return 1;
   }
 
-  if(res == -5) // guessed s[i], but s[j] was determinstic, so let's increase the counters for the next time
-                // This case is valid in the sence that we should launch update_state
-		// and go deeper into recursion
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  while((n = getline(&line, &cap, b->in)) >= 0)
   {
-    s.guessed_si++;// = 1;
-    s.guessed_sj = -1;
+    while(n > 0 && (line[n-1] == '\n' || line[n-1] == '\r' || line[n-1] == ' ' || line[n-1] == '\t'))
+      line[--n] = 0;
+    if(n == 0 || line[0] == '#')
+      continue;
+    if(n/2 > MAX_JOB_LEN)
+    {
+      free(line);
+      return -2;
+    }
+    *z_len = n/2;
+    *z = (uint8_t *)malloc(*z_len > 0 ? *z_len : 1);
+    if(*z == NULL || n%2 != 0 || fromHex(*z, (uint8_t *)line, *z_len, 0) < 0)
+    {
+      free(*z);
+      *z = NULL;
+      free(line);
+      return -1;
+    }
+    free(line);
+    return 1;
   }
+  free(line);
+  return 0;
+}
+
+/* Batch worker: solve jobs until the input is exhausted */
+void *batch_worker(void *arg)
+{
+  batch *b = (batch *)arg;
 
-  // -4 means that S[i] and S[j] were fixed, so we did not do any guesses 
-  if( (res == 0) || (res == -5) || (res == -4) )
+  while(1)
   {
-    *ret = 0;
-    finalize_step(&s); // Update inverse permutation
+    uint8_t *z;
+    int z_len, l;
+    pthread_mutex_lock(&b->in_lock);
+    long job = b->next_job++;
+    int got = b->failed ? 0 : read_job(b, &z, &z_len);
+    pthread_mutex_unlock(&b->in_lock);
+    if(got == 0)
+      break;
+
+    const char *error = NULL;
+    if(got == -2)
+      error = "keystream too long";
+    else if(got < 0)
+      error = "malformed keystream";
+    else
+      for(l=0;l<z_len && error == NULL;l++)
+        if(z[l] >= b->size)
+          error = "keystream value out of range for the word size";
+
+    struct recovery_params p = b->p;
+    struct recovery_result res;
+    long found = 0;
+    struct timespec t0, t1;
+    if(error == NULL)
+    {
+      p.z = z;
+      p.z_len = z_len;
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      found = b->k->solve(&p, &res);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+    }
+
+    if(error == NULL && found < 0)
+    {
+      error = res.error;
+      found = 0;
+    }
+
+    pthread_mutex_lock(&b->out_lock);
+    if(error != NULL)
+      printf("{\"job\":%ld,\"error\":\"%s\"}\n", job, error);
+    else
+    {
+      double ms = (t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)*1e-6;
+      printf("{\"job\":%ld,\"len\":%d,\"found\":%ld,\"ms\":%.3f,\"nodes\":%ld", job, z_len, found, ms, res.nodes);
+      if(res.status == RECOVERY_BUDGET)
+        printf(",\"stopped\":\"max-nodes\"");
+      if(found && !p.all)
+      {
+        printf(",");
+        print_json_fields(stdout, &res);
+      }
+      printf("}\n");
+      if(found)
+        b->solved++;
+    }
+    fflush(stdout);
+    b->done++;
+    pthread_mutex_unlock(&b->out_lock);
+    free(z);
   }
-  return s;
+  return NULL;
 }
 
-/* Get the next candidate for backtracking
- * 
- * Makes a copy of candidate <c>, invokes RC4 step and returns with
- * a code which describes if the guesses during the step went OK
+/* Run all jobs of <name> ("-" for stdin) on <nthreads> threads
  *
- * @param c Candidate from which to derive the one for recursion
- * @param z Keystream
- * @param ret Return code (we need it because we also need to return the new candidate)
- * @param s Next candidate for backtracking
+ * @param name Input file
+ * @param binary Set for length prefixed binary records
+ * @param alpha Word size
+ * @param nthreads Number of jobs solved at the same time
+ * @param p Options of every job (sequential search)
+ * @return 0 on success, -1 if the input cannot be opened or not all
+ *         threads can be started (the jobs done so far are printed)
 */
-candidate next(candidate c, candidate prev_s, uint8_t *z, int *ret)
+int run_batch(const char *name, int binary, int alpha, int nthreads, struct recovery_params *p)
 {
-  candidate s = c;
+  batch b;
+  int l;
 
-  // Returns 0 if everything is good
-  int res = step(&s, prev_s.guessed_si, prev_s.guessed_sj+1); // Make a step and guess permutation entries if necessary
+  memset(&b, 0, sizeof(b));
+  b.in = strcmp(name, "-") == 0 ? stdin : fopen(name, binary ? "rb" : "r");
+  if(b.in == NULL)
+  {
+    fprintf(stderr, "Cannot open %s\n", name);
+    return -1;
+  }
+  b.binary = binary;
+  b.size = 1<<alpha;
+  b.k = recovery_select(alpha);
+  b.p = *p;
+  b.p.nworkers = 1;
+  b.p.on_solution = NULL; // -a only counts the states of each job
+  b.p.stats = NULL;
+  b.p.progress = NULL;
+  pthread_mutex_init(&b.in_lock, NULL);
+  pthread_mutex_init(&b.out_lock, NULL);
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pthread_t *threads = (pthread_t *)malloc(nthreads*sizeof(pthread_t));
+  int started = 0;
+  if(threads == NULL)
+    fprintf(stderr, "Out of memory\n");
+  else
+    for(started=0;started<nthreads;started++)
+    {
+      int err = pthread_create(&threads[started], NULL, batch_worker, &b);
+      if(err != 0)
+      {
+        fprintf(stderr, "Cannot start batch thread %d of %d: %s\n", started+1, nthreads, strerror(err));
+        pthread_mutex_lock(&b.in_lock);
+        b.failed = 1; // the threads already running stop after their current job
+        pthread_mutex_unlock(&b.in_lock);
+        break;
+      }
+    }
+  for(l=0;l<started;l++)
+    pthread_join(threads[l], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+  fprintf(stderr, "Batch: %ld jobs, %ld solved, %.3f s, %.1f jobs/s\n", b.done, b.solved, secs, secs > 0 ? b.done/secs : 0);
+
+  free(threads);
+  pthread_mutex_destroy(&b.in_lock);
+  pthread_mutex_destroy(&b.out_lock);
+  if(b.in != stdin)
+    fclose(b.in);
+  return started < nthreads ? -1 : 0;
+}
 
-  if(res == -1) // cannot guess s[i], end
-    *ret = 1;
+/* Key search and the planner
+ *
+ * With --key-len the keystream can also be attacked by enumerating the
+ * keys (see keysearch.c). The planner compares the expected time of both
+ * solvers: the key search tests SIZE^K keys (half of them on average when
+ * only the first key is wanted), the backtracking explores a tree of the
+ * typical size for the word size. The costs per key and per node were
+ * measured on the same machine, only their ratio matters, so the choice
+ * depends neither on the machine nor on the number of threads.
+*/
 
-  if(res == -4) // no guessing is happenning at all (and corresponding s[i] and s[j] value were already considered in the first() function), end
-    *ret = 1;
+enum solver { SOLVER_AUTO, SOLVER_STATE, SOLVER_KEY };
 
-  if(res == -3) // cannot guess s[j], and cannot re-guess s[i] (it's fixed), end
-    *ret = 1;
+// Typical number of nodes of the backtracking for ALPHA=3..8: medians from
+// 'make bench' for ALPHA 3 and 4, rough extrapolations above
+static const double typical_nodes[] = { 3e2, 2e6, 1e10, 1e14, 1e18, 1e22 };
+// Nanoseconds per node of the backtracking and per key of the key search, ALPHA=3..8
+static const double node_ns[] = { 140, 55, 60, 60, 60, 60 };
+static const double key_ns[] = { 50, 80, 110, 150, 360, 500 };
 
+/* Pick the cheaper solver for a keystream and print the estimate to stderr
+ *
+ * @param alpha Word size
+ * @param key_len Key length in bytes
+ * @param all Set if all solutions are wanted
+ * @return SOLVER_KEY or SOLVER_STATE
+*/
+int plan_solver(int alpha, int key_len, int all)
+{
+  uint64_t nkeys = keysearch_keyspace(alpha, key_len);
+  double state_s = typical_nodes[alpha-ALPHA_MIN] * node_ns[alpha-ALPHA_MIN] * 1e-9;
 
-  if(res == -2) // cannot guess s[j], but can re-guess s[i]
-                // In this case we did not really assign any new values, so we should no go
-		// deeper into recursion (nor update inverse permutation)
-		// for this case; at the same time we should not interrupt
-		// the current level of recursion
+  if(nkeys == 0)
   {
-    s.guessed_si++;
-    s.guessed_sj = -1;
-    *ret = 2; // skip current candidate in the candidate cycle, and to next
+    fprintf(stderr, "Plan: the keyspace of %d byte keys is too large, backtracking ~%.3g s\n", key_len, state_s);
+    return SOLVER_STATE;
   }
+  double key_s = (double)nkeys * (all ? 1 : 0.5) * key_ns[alpha-ALPHA_MIN] * 1e-9;
+  int solver = key_s < state_s ? SOLVER_KEY : SOLVER_STATE;
+  fprintf(stderr, "Plan: key search of 2^%d keys ~%.3g s, backtracking ~%.3g s: %s\n", alpha*key_len,
+          key_s, state_s, solver == SOLVER_KEY ? "key search" : "backtracking");
+  return solver;
+}
 
-  if(res == -5) // guessed s[i], but s[j] was determinstic, so let's increae the counters for the next time
+/* Estimate the search instead of running it: a JSON line to stdout, a summary to stderr
+ *
+ * @param k Kernels of the word size
+ * @param p Keystream and search options
+ * @param probes Number of probes
+ * @return Exit code
+*/
+int run_estimate(const struct recovery_kernels *k, struct recovery_params *p, int probes)
+{
+  struct recovery_estimate est;
+
+  if(k->estimate(p, probes, &est) < 0)
   {
-    s.guessed_si++;
-    s.guessed_sj = -1;
+    fprintf(stderr, "Estimate failed: %s\n", est.error);
+    return 1;
   }
-    
-  if( (res == 0) || (res == -5) )
+  printf("{\"probes\":%d,\"nodes\":%.6g,\"low\":%.6g,\"high\":%.6g,\"nodes_per_sec\":%.6g,\"seconds\":%.6g}\n",
+         est.probes, est.nodes, est.low, est.high, est.nodes_per_sec, est.seconds);
+  fprintf(stderr, "Estimated search tree: %.3g nodes (95%% interval %.3g .. %.3g, %d probes)\n",
+          est.nodes, est.low, est.high, est.probes);
+  fprintf(stderr, "Measured speed: %.3g nodes/s, whole tree on one thread: %.3g s (%.3g .. %.3g s)\n",
+          est.nodes_per_sec, est.seconds, est.seconds*(est.low/est.nodes), est.seconds*(est.high/est.nodes));
+  return 0;
+}
+
+/* Print a key found in exhaustive mode as one JSON line, with its last state
+ *
+ * Used as the key callback of the key search
+*/
+int print_key_json(uint8_t *key, int key_len, struct recovery_result *state, void *arg)
+{
+  FILE *out = (FILE *)arg;
+  char hex[2*KEYSEARCH_MAX_KEY+1];
+
+  toHex((uint8_t *)hex, key, key_len, 0);
+  fprintf(out, "{\"key\":\"%s\",", hex);
+  print_json_fields(out, state);
+  fprintf(out, "}\n");
+  fflush(out);
+  return 0;
+}
+
+/* Search the keys of <key_len> bytes that produce keystream <z> and print them
+ *
+ * @return 0
+*/
+int run_key_search(int alpha, uint8_t *z, int z_len, int key_len, int nworkers, int all)
+{
+  struct keysearch_params kp;
+  struct keysearch_result kr;
+  char hex[2*KEYSEARCH_MAX_KEY+1];
+
+  kp.z = z;
+  kp.z_len = z_len;
+  kp.key_len = key_len;
+  kp.nworkers = nworkers;
+  kp.all = all;
+  kp.on_key = print_key_json;
+  kp.arg = stdout;
+  if(!all)
+    printf("Starting key search of RC4-%d (%d byte keys, %d threads)...\n", 1<<alpha, key_len, nworkers);
+  long n = keysearch_select(alpha)->search(&kp, &kr);
+  if(all)
+    fprintf(stderr, "Found %ld keys consistent with the keystream\n", n);
+  else if(n > 0)
   {
-    *ret = 0;
-    finalize_step(&s); // Update inverse permutation
+    toHex((uint8_t *)hex, kr.key, key_len, 0);
+    printf(" ** Key found: %s ** \n", hex);
+    print_result(&kr.state);
   }
-  return s;
+  else
+    printf("No key of %d bytes produces the keystream\n", key_len);
+  fprintf(stderr, "Tested %llu keys in %.3f s (%.2f M keys/s)\n", (unsigned long long)kr.keys, kr.seconds,
+          kr.seconds > 0 ? kr.keys/kr.seconds*1e-6 : 0);
+  return 0;
 }
 
+/* Keystream read with --input
+ *
+ * Hex digits (whitespace between them is ignored) or, with --binary, raw
+ * bytes. A raw keystream in a regular file is mmap()ed and used in place.
+ * With --incremental a thread reads the input while the search runs and
+ * hands the bytes over through <feed>.
+*/
+struct input_struct
+{
+  const char *name;
+  int fd;
+  int binary; // raw bytes instead of hex digits
+  int size; // keystream values must be below this
+  uint8_t *z;
+  int z_len; // bytes read so far
+  int cap; // room in <z>
+  int grow; // reallocate <z> when it is full (the whole input is read first)
+  size_t mapped; // length of the mmap()ed file, 0 if <z> was malloc()ed
+  struct hex_stream hex; // hex input: a byte may be split between two reads
+  const char *error; // why the input was cut short, NULL if it was not
+  struct keystream_feed feed; // --incremental
+};
 
-/* Return empty candidate at the root of the search tree for backtracking.
+typedef struct input_struct input;
+
+/* Open <name> ("-" for stdin)
  *
- * The permutation's entries are set to -1
- * The reverse permutation's entries are set to -1
- * i and j are set to 0
- * t (current step) is set to -1
+ * @return 0 on success, -1 if the file cannot be opened
 */
-candidate root()
+int open_input(input *in, const char *name, int binary, int alpha)
 {
-  candidate c;
-  int l = 0;
-  for(l = 0; l < SIZE; l++)
-    c.s[l] = -1;
-  for(l = 0; l < SIZE; l++)
-    c.inv_s[l] = -1;
-  //c.s = s;
-  c.i = 0;
-  c.j = 0;
-  c.nguessed = 0;
-  c.idx = -1;
-  c.t = -1;
-  c.guessed_si = 0;
-  c.guessed_sj = 0;
-  return c;
+  memset(in, 0, sizeof(*in));
+  in->name = name;
+  in->fd = strcmp(name, "-") == 0 ? 0 : open(name, O_RDONLY);
+  in->binary = binary;
+  in->size = 1 << alpha;
+  hexStreamInit(&in->hex);
+  return in->fd < 0 ? -1 : 0;
 }
 
-/* Update the permutation and inverse permutation based on the
- * keystream. Return -1 if there is a contradiction:
- * Each new value we add to the permutation <s> should be either different from
- * the existing elements or should have the same index.
+/* Append the keystream bytes of <n> bytes of input to in->z
  *
- * @param c Candidate to update
- * @param z Keystream
- * @return  0 No contradictions
- *         -1 There was a contradiction with the current state
+ * Raw bytes are copied as they are, hex digits are converted HEX_CHUNK
+ * bytes at a time with fromHexChunk().
+ *
+ * @return 0 on success, -1 if the keystream ends here (in->error says why)
 */
-int update_state(candidate *c, uint8_t *z)
-{
-    int i = c->i;
-    int j = c->j;
-    int t = c->t;
-    int *s = c->s;
-    int *inv_s = c->inv_s;
-    int zt = (int)z[t];
-
-    DEBUG_PRINT(("update_state(): zt=%d\n",zt));
-    DEBUG_PRINT(("update_state(): inv_s[zt]=%d\n",inv_s[zt]));
-    DEBUG_PRINT(("update_state(): j=%d\n",j));
-    if (j != -1)
+int append_input(input *in, const uint8_t *buf, int n)
+{
+  uint8_t bytes[HEX_CHUNK];
+  while(n > 0)
+  {
+    const uint8_t *z = buf;
+    int take = n, m = n, l;
+    if(!in->binary)
     {
-      DEBUG_PRINT(("update_state(): s[j=%d] is %s\n",j, (s[j] != -1) ? "known" : "not known"));
+      take = n < 2*HEX_CHUNK ? n : 2*HEX_CHUNK;
+      m = fromHexChunk(&in->hex, bytes, buf, take);
+      z = bytes;
     }
-    DEBUG_PRINT(("update_state(): s[i=%d] is %s\n",i, (s[i] != -1) ? "known" : "not known"));
-
-    // If S[i_t], S[j_t], and j_t are known, add Z[t] to the permutation
-    if( (s[i] != -1) && (j != -1 ) && (s[j] != -1) )
+    for(l=0;l<m && z[l]<in->size;l++)
+      ;
+    int good = l; // bytes before the first one out of range
+    while(in->z_len + good > in->cap && in->grow)
     {
-      int idx = ind(s[i]+s[j]);
-
-      if ( ((s[idx] != -1) &&  (s[idx] != zt)) )
+      in->cap = in->cap ? 2*in->cap : 4096;
+      in->z = (uint8_t *)realloc(in->z, in->cap);
+      if(in->z == NULL)
       {
-        DEBUG_PRINT(("Was trying to update s[s[i]+s[j]=%d] with zt=%d (already occupied with %d)\n", idx, zt, s[idx]));
-        return -1;
+        printf("Out of memory\n");
+        exit(-1);
       }
+    }
+    if(in->z_len + good > in->cap)
+    {
+      memcpy(in->z + in->z_len, z, in->cap - in->z_len);
+      in->z_len = in->cap;
+      in->error = "keystream longer than --max-len, the rest is ignored";
+      return -1;
+    }
+    memcpy(in->z + in->z_len, z, good);
+    in->z_len += good;
+    if(good < m)
+    {
+      in->error = "keystream value out of range for the word size";
+      return -1;
+    }
+    if(in->hex.malformed)
+    {
+      in->error = "malformed keystream";
+      return -1;
+    }
+    buf += take;
+    n -= take;
+  }
+  return 0;
+}
 
-      if ( (inv_s[zt] != -1) && (inv_s[zt] != idx) )
-      {
-        DEBUG_PRINT(("Was trying to update s[s[i]+s[j]=%d] with zt=%d (zt already appear at index %d)\n", idx, zt, inv_s[zt]));
-        return -1;
-      }
-      DEBUG_PRINT(("Updating s[s[i]+s[j]=%d] with zt=%d\n", idx, zt));
-      s[idx] = zt;
-      inv_s[zt] = idx;
+/* Read the whole input into in->z (or map it there)
+ *
+ * @return 0 on success, -1 on errors (in->error says why)
+*/
+int read_input(input *in)
+{
+  struct stat st;
+  uint8_t buf[1<<16];
+  ssize_t n;
+  size_t l;
+
+  if(in->binary && fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size < INT_MAX)
+  {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if(m != MAP_FAILED)
+    {
+      in->z = (uint8_t *)m;
+      in->z_len = in->cap = st.st_size;
+      in->mapped = st.st_size;
+      for(l=0;l<in->mapped;l++)
+        if(in->z[l] >= in->size)
+        {
+          in->error = "keystream value out of range for the word size";
+          return -1;
+        }
+      return 0;
     }
+  }
 
-    // If S⁻¹[zₜ], jₜ, and S[iₜ] are known, determine S[jₜ]
-    if( (inv_s[zt] != -1) && (j != -1 ) && (s[i] != -1) )
+  in->grow = 1;
+  while((n = read(in->fd, buf, sizeof(buf))) != 0)
+  {
+    if(n < 0)
     {
-      int entry = ind(inv_s[zt]-s[i]); 
-      if( (s[j] != entry) && (s[j] != -1) )  // if the entry already appears in the permutation with a different index
-      {
-        DEBUG_PRINT(("Entry %d already appears in the permutation with index different from j\n", entry));
-        return -1;
-      }
-      DEBUG_PRINT(("Updating s[j=%d] with inv_s[zt]-s[i]=%d\n", j, entry));
-      s[j] = entry;
-      inv_s[entry] = j;
+      in->error = strerror(errno);
+      return -1;
     }
+    if(append_input(in, buf, n) < 0)
+      return -1;
+  }
+  if(in->hex.digit >= 0)
+    in->error = "odd number of hex digits";
+  return in->error != NULL ? -1 : 0;
+}
 
-    // If S⁻¹[Z_t], j_t, and S[j_t] are known, determine S[i_t]
-    if( (inv_s[zt] != -1) && (j != -1 ) && (s[j] != -1) )
+/* Reader thread of --incremental: passes the input to the search as it arrives */
+void *input_reader(void *arg)
+{
+  input *in = (input *)arg;
+  uint8_t buf[1<<12];
+  ssize_t n;
+
+  while((n = read(in->fd, buf, sizeof(buf))) != 0)
+  {
+    if(n < 0)
     {
-      int entry = ind(inv_s[zt]-s[j]); 
-      if( (s[i] != entry) && (s[i] != -1) ) // if the entry already appears in the permutation with a different index
-      {
-        DEBUG_PRINT(("Entry %d appears in the permutation with index different from i\n", entry));
-        return -1;
-      }
-      DEBUG_PRINT(("Updating s[i=%d] with inv_s[zt]-s[j]=%d\n", i, entry));
-      s[i] = entry;
-      inv_s[entry] = i;
+      in->error = strerror(errno);
+      break;
     }
+    int ret = append_input(in, buf, n);
+    // the search only looks at the first feed.avail bytes, so z was written without the lock
+    pthread_mutex_lock(&in->feed.lock);
+    in->feed.avail = in->z_len;
+    pthread_cond_broadcast(&in->feed.more);
+    pthread_mutex_unlock(&in->feed.lock);
+    if(ret < 0)
+      break;
+  }
+  if(in->error == NULL && in->hex.digit >= 0)
+    in->error = "odd number of hex digits";
+  if(in->error != NULL)
+    fprintf(stderr, "%s: %s\n", in->name, in->error);
+  pthread_mutex_lock(&in->feed.lock);
+  in->feed.done = 1;
+  pthread_cond_broadcast(&in->feed.more);
+  pthread_mutex_unlock(&in->feed.lock);
+  return NULL;
+}
+
+/* Start reading the input in the background into a buffer of <cap> bytes */
+void start_input_reader(input *in, int cap)
+{
+  pthread_t thread;
 
-    if( (s[i] != -1) && (inv_s[zt] != -1) && (inv_s[ind(inv_s[zt]-s[i])] != -1) )
+  in->z = (uint8_t *)malloc(cap);
+  in->cap = cap;
+  if(in->z == NULL)
+  {
+    printf("Out of memory\n");
+    exit(-1);
+  }
+  pthread_mutex_init(&in->feed.lock, NULL);
+  pthread_cond_init(&in->feed.more, NULL);
+  pthread_create(&thread, NULL, input_reader, in);
+  pthread_detach(thread);
+}
+
+/* Add hints to <h>: comma or whitespace separated t=T (position of the
+ * hints), j=J and x=v (S[x] is v); '#' starts a comment up to the end of
+ * the line. The values are checked against the word size by check_hints().
+ *
+ * @return 0 on success, -1 if the hints are malformed
+*/
+int parse_hints(char *spec, struct recovery_hints *h)
+{
+  char *line, *tok, *save_line = NULL, *save = NULL;
+
+  for(line = strtok_r(spec, "\n", &save_line); line != NULL; line = strtok_r(NULL, "\n", &save_line))
+  {
+    char *comment = strchr(line, '#');
+    if(comment != NULL)
+      *comment = 0;
+    for(tok = strtok_r(line, ", \t\r", &save); tok != NULL; tok = strtok_r(NULL, ", \t\r", &save))
     {
-      j = inv_s[ind(inv_s[zt]-s[i])];
-      if(c->j != j) // the computed value of <j> does not coincide with the one set before => contradicition
-      {
-        DEBUG_PRINT(("the computed value of <j> does not coincide with the one set before\n"));
+      char key[16], rest;
+      int x, v;
+      if(sscanf(tok, "%15[^=]=%d%c", key, &v, &rest) != 2)
         return -1;
+      if(strcmp(key, "t") == 0)
+        h->t = v;
+      else if(strcmp(key, "j") == 0)
+        h->j = v;
+      else if(sscanf(key, "%d%c", &x, &rest) == 1 && x >= 0 && x < MAX_SIZE && v >= 0 && v < MAX_SIZE && h->n < MAX_SIZE)
+      {
+        h->x[h->n] = x;
+        h->v[h->n++] = v;
       }
+      else
+        return -1;
     }
-
-    return 0; // no contradiction
+  }
+  return 0;
 }
 
+/* Read hints from a file, see parse_hints()
+ *
+ * @return 0 on success, -1 if the file cannot be read or is malformed
+*/
+int read_hints(const char *name, struct recovery_hints *h)
+{
+  FILE *f = fopen(name, "r");
+  char *text = NULL;
+  size_t cap = 0;
 
-/* Main backtracking procedure
+  if(f == NULL)
+    return -1;
+  ssize_t n = getdelim(&text, &cap, 0, f); // the whole file
+  fclose(f);
+  int ret = n < 0 ? -1 : parse_hints(text, h);
+  free(text);
+  return ret;
+}
 
-   Takes a solution candidate, updates/checks for contradictions of
-   its permutation <s> based on the current byte in the key stream.
-   If there are not contradiction, make another step (i.e. read the next
-   keystream byte), and go deeper into recursion.
-   If the end of the keystream is reached, print a success message,
-   and print the current candidate.
+/* Check that the hints fit the word size and a keystream of <z_len> bytes
+ *
+ * @return 0 if they do, -1 otherwise
+*/
+int check_hints(struct recovery_hints *h, int alpha, int z_len)
+{
+  int size = 1 << alpha;
+  int l;
+
+  if(h->t < -1 || h->t >= z_len || h->j < -1 || h->j >= size)
+    return -1;
+  for(l=0;l<h->n;l++)
+    if(h->x[l] >= size || h->v[l] >= size)
+      return -1;
+  return 0;
+}
 
-   @param c Current candidate with partially filled permutation
-   @param z Keystream
-   @param z_len lenght of the keystream
-   @return 0
+/* Tell why the search stopped, if it did not simply finish
+ *
+ * @param p Parameters of the search
+ * @param res Result of the search
+ * @param out Stream for the messages of a search that stopped early
+ * @return 0, -1 if the search failed (the error went to stderr)
 */
-int bt(candidate c, uint8_t *z, int z_len)
+int report_status(struct recovery_params *p, struct recovery_result *res, FILE *out)
 {
-  int ret = 0;
-  DEBUG_PRINT(("\n============================================\n"));
-  DEBUG_PRINT((" ==> Invoking bt (t=%d).\n", c.t));
-  DEBUG_PRINT((" => Update and check.\n"));
-  if(update_state(&c, z) < 0)  // check for contradiction
+  if(res->checkpoint_failures > 0)
+    fprintf(stderr, "Cannot save checkpoint to %s (%d times)\n", p->checkpoint, res->checkpoint_failures);
+  switch(res->status)
   {
-    DEBUG_PRINT((" ==> Dead candidate\n"));
-    return 0;
+    case RECOVERY_INTERRUPTED:
+      fprintf(out, "Interrupted, checkpoint saved to %s\n", p->checkpoint);
+      break;
+    case RECOVERY_BUDGET:
+      fprintf(out, "Gave up after %ld nodes\n", res->nodes);
+      break;
+    case RECOVERY_BAD_CHECKPOINT:
+      fprintf(stderr, "Cannot resume from %s: %s\n", p->checkpoint, res->error);
+      return -1;
+    case RECOVERY_ERROR:
+      fprintf(stderr, "Search failed: %s\n", res->error);
+      return -1;
   }
-  DEBUG_PRINT(("The updated candidate is:\n"));
+  return 0;
+}
+
+void usage()
+{
+  printf("Recover RC4 internal state from a keystream\n");
+  printf("Use ./rc4test to generate a keystream\n\n");
+  printf("Usage: state-recovery [--alpha N] [--stats] [--checkpoint FILE [--interval SECS] [--resume]]\n");
+  printf("                      [--shard K/N [--shard-depth D] [--shard-out FILE]] [-a] [-l K] [-j THREADS] [-s DEPTH] KEYSTREAMHEX\n");
+  printf("       state-recovery --merge [--stats] SHARDFILE...\n");
+  printf("       state-recovery --batch FILE [--binary] [-a] [-l K] [-j THREADS]\n");
+  printf("       state-recovery --key-len K [--solver auto|key|state] [-a] [-j THREADS] KEYSTREAMHEX\n");
+  printf("       state-recovery --input FILE [--binary] [--incremental [--max-len N]] [OPTIONS]\n");
+  printf("       state-recovery [--hint HINTS]... [--hints FILE] [OPTIONS] KEYSTREAMHEX\n");
+  printf("       state-recovery --order ascending|biased [OPTIONS] KEYSTREAMHEX\n");
+  printf("       state-recovery --portfolio N [--restart-unit NODES] [OPTIONS] KEYSTREAMHEX\n");
+  printf("       state-recovery --estimate PROBES [OPTIONS] KEYSTREAMHEX\n");
+  printf("       state-recovery --max-nodes N [OPTIONS] KEYSTREAMHEX\n");
+  printf("          --alpha N	word size in bits, %d..%d (default %d)\n", ALPHA_MIN, ALPHA_MAX, DEFAULT_ALPHA);
+  printf("          --stats	print search statistics to stderr on exit (also on SIGUSR1)\n");
+  printf("          --checkpoint FILE	save the position of the search to FILE (sequential search only),\n");
+  printf("          		also on SIGINT/SIGTERM, which stop the search\n");
+  printf("          --interval SECS	seconds between checkpoints (default %d)\n", DEFAULT_CHECKPOINT_INTERVAL);
+  printf("          --resume	continue from the checkpoint\n");
+  printf("          --shard K/N	explore only the K-th of N slices of the search tree (0 <= K < N)\n");
+  printf("          --shard-depth D	split the tree D keystream bytes below the root (default %d)\n", DEFAULT_SHARD_DEPTH);
+  printf("          --shard-out FILE	write the states found and the statistics of the shard to FILE\n");
+  printf("          --merge	combine the shard files of all shards and print the result\n");
+  printf("          --batch FILE	recover every keystream in FILE (- for stdin), -j jobs at a time,\n");
+  printf("          		one JSON record per job in completion order\n");
+  printf("          --input FILE	read the keystream from FILE (- for stdin) instead of the command line:\n");
+  printf("          		hex digits (whitespace is ignored), or raw bytes with --binary\n");
+  printf("          --incremental	start the search while --input is still being read (e.g. from a pipe);\n");
+  printf("          		not with --checkpoint, --shard, --shard-out or the key search\n");
+  printf("          --max-len N	keystream bytes kept with --incremental (default %d)\n", DEFAULT_MAX_LEN);
+  printf("          --binary	--input is raw keystream bytes (mapped into memory if it is a file);\n");
+  printf("          		batch input is 4 byte little endian lengths followed by keystream bytes\n");
+  printf("          --key-len K	the key has K bytes: let the planner choose between key search and backtracking\n");
+  printf("          --solver S	auto (default with --key-len), key (enumerate the keys) or state (backtracking)\n");
+  printf("          --hint HINTS	start from a partially known state, e.g. t=40,j=3,0=12,5=1: the state right\n");
+  printf("          		after keystream byte t (default -1, the start) with j and S[x]=v known\n");
+  printf("          --hints FILE	read hints from FILE, whitespace separated, # starts a comment\n");
+  printf("          --order O	order in which values are guessed: ascending (default) or biased, most\n");
+  printf("          		likely first under the key schedule and glimpse biases\n");
+  printf("          --portfolio N	race N solver configurations, one thread each: the two orders and\n");
+  printf("          		randomized orders restarted on a Luby schedule (not with -j, -a,\n");
+  printf("          		--checkpoint or --shard)\n");
+  printf("          --restart-unit NODES	first node limit of the randomized members (default %d)\n", DEFAULT_RESTART_UNIT);
+  printf("          --estimate PROBES	estimate the size of the search tree with PROBES random probes and\n");
+  printf("          		the time to search it instead of searching (JSON to stdout)\n");
+  printf("          --max-nodes N	give up after about N nodes (also per --batch job)\n");
+  printf("          -a		find all consistent states and print them as JSON lines\n");
+  printf("          -l K		check the next K keystream bytes for each candidate (default 0)\n");
+  printf("          -j THREADS	number of worker threads (default 1)\n");
+  printf("          -s DEPTH	share candidates with t < DEPTH between threads (default %d)\n", DEFAULT_SPLIT_DEPTH);
 #ifdef DEBUG
-  debug_print_candidate(&c);
+  printf("\nDEBUG_PRINT is ENABLED\n");
 #endif
-  DEBUG_PRINT(("\n\n\n => Getting first candidate (t=%d).\n", c.t));
-  if(c.t >= z_len-1)
+  exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option long_options[] =
   {
-    printf(" ** Success (t=%d) Press any key ** \n", c.t);
-    print_candidate(&c);
-    printf("Print any key to continue search or CTRL-C to interrupt\n");
-    //getchar();
-    exit(0);
+    {"alpha", required_argument, 0, 'A'},
+    {"stats", no_argument, 0, 'S'},
+    {"checkpoint", required_argument, 0, 'C'},
+    {"interval", required_argument, 0, 'I'},
+    {"resume", no_argument, 0, 'R'},
+    {"shard", required_argument, 0, 'K'},
+    {"shard-depth", required_argument, 0, 'D'},
+    {"shard-out", required_argument, 0, 'O'},
+    {"merge", no_argument, 0, 'M'},
+    {"batch", required_argument, 0, 'B'},
+    {"binary", no_argument, 0, 'b'},
+    {"key-len", required_argument, 0, 'k'},
+    {"solver", required_argument, 0, 'P'},
+    {"input", required_argument, 0, 'i'},
+    {"incremental", no_argument, 0, 'N'},
+    {"max-len", required_argument, 0, 'L'},
+    {"hint", required_argument, 0, 'H'},
+    {"hints", required_argument, 0, 'F'},
+    {"order", required_argument, 0, 'o'},
+    {"portfolio", required_argument, 0, 'p'},
+    {"restart-unit", required_argument, 0, 'u'},
+    {"estimate", required_argument, 0, 'e'},
+    {"max-nodes", required_argument, 0, 'n'},
+    {0, 0, 0, 0}
+  };
+  struct recovery_params p;
+  struct recovery_result res;
+  struct recovery_stats stats;
+  int alpha = DEFAULT_ALPHA;
+  int show_stats = 0;
+  char *shard_out = NULL;
+  int merge = 0;
+  char *batch_in = NULL;
+  int binary = 0;
+  int key_len = 0;
+  int solver = SOLVER_AUTO;
+  char *input_name = NULL;
+  int incremental = 0;
+  int max_len = DEFAULT_MAX_LEN;
+  struct recovery_hints hints;
+  int use_hints = 0;
+  int probes = 0;
+  int l;
+  struct state_list found;
+  int opt;
+
+  p.nworkers = 1;
+  p.split_depth = DEFAULT_SPLIT_DEPTH;
+  p.lookahead = 0;
+  p.all = 0;
+  p.on_solution = print_json;
+  p.arg = stdout;
+  p.progress = &progress_requested;
+  p.on_progress = print_stats;
+  p.progress_arg = stderr;
+  p.checkpoint = NULL;
+  p.checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+  p.resume = 0;
+  p.interrupt = &interrupt_requested;
+  p.cancel = NULL;
+  p.max_nodes = 0;
+  p.shard = 0;
+  p.nshards = 1;
+  p.shard_depth = DEFAULT_SHARD_DEPTH;
+  p.feed = NULL;
+  p.hints = NULL;
+  p.order = ORDER_ASCENDING;
+  p.portfolio = 0;
+  p.restart_unit = DEFAULT_RESTART_UNIT;
+  hints.t = -1;
+  hints.j = -1;
+  hints.n = 0;
+  memset(&found, 0, sizeof(found));
+  while((opt = getopt_long(argc, argv, "al:j:s:", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 'A': alpha = atoi(optarg); break;
+      case 'S': show_stats = 1; break;
+      case 'C': p.checkpoint = optarg; break;
+      case 'I': p.checkpoint_interval = atoi(optarg); break;
+      case 'R': p.resume = 1; break;
+      case 'K':
+        if(sscanf(optarg, "%d/%d", &p.shard, &p.nshards) != 2)
+          usage();
+        break;
+      case 'D': p.shard_depth = atoi(optarg); break;
+      case 'O': shard_out = optarg; break;
+      case 'M': merge = 1; break;
+      case 'B': batch_in = optarg; break;
+      case 'b': binary = 1; break;
+      case 'k': key_len = atoi(optarg); break;
+      case 'P':
+        if(strcmp(optarg, "auto") == 0)
+          solver = SOLVER_AUTO;
+        else if(strcmp(optarg, "key") == 0)
+          solver = SOLVER_KEY;
+        else if(strcmp(optarg, "state") == 0)
+          solver = SOLVER_STATE;
+        else
+          usage();
+        break;
+      case 'i': input_name = optarg; break;
+      case 'N': incremental = 1; break;
+      case 'L': max_len = atoi(optarg); break;
+      case 'H':
+        if(parse_hints(optarg, &hints) < 0)
+        {
+          fprintf(stderr, "Malformed hints: %s\n", optarg);
+          return 1;
+        }
+        use_hints = 1;
+        break;
+      case 'F':
+        if(read_hints(optarg, &hints) < 0)
+        {
+          fprintf(stderr, "Cannot read hints from %s\n", optarg);
+          return 1;
+        }
+        use_hints = 1;
+        break;
+      case 'o':
+        if(strcmp(optarg, "ascending") == 0)
+          p.order = ORDER_ASCENDING;
+        else if(strcmp(optarg, "biased") == 0)
+          p.order = ORDER_BIASED;
+        else
+          usage();
+        break;
+      case 'p': p.portfolio = atoi(optarg); break;
+      case 'u': p.restart_unit = atol(optarg); break;
+      case 'e':
+        probes = atoi(optarg);
+        if(probes < 1)
+          usage();
+        break;
+      case 'n':
+        p.max_nodes = atol(optarg);
+        if(p.max_nodes < 1)
+          usage();
+        break;
+      case 'a': p.all = 1; break;
+      case 'l': p.lookahead = atoi(optarg); break;
+      case 'j': p.nworkers = atoi(optarg); break;
+      case 's': p.split_depth = atoi(optarg); break;
+      default: usage();
+    }
   }
-  candidate s = first(c, z, &ret); // Do step here
-#ifdef DEBUG
-  debug_print_candidate(&s);
-#endif
-  //sanity_check(&s);
-
-  int num = 1;
-  while( (ret == 0) || (ret == 2) )
+  if(merge)
+  {
+    if(optind == argc)
+      usage();
+    return merge_shards(argv+optind, argc-optind, show_stats);
+  }
+  const struct recovery_kernels *k = recovery_select(alpha);
+  if(p.nshards < 1 || p.shard < 0 || p.shard >= p.nshards || p.shard_depth < 1)
+    usage();
+  if(batch_in != NULL)
+  {
+    if(optind != argc || k == NULL || p.nworkers < 1 || p.checkpoint != NULL || p.nshards > 1 || use_hints || p.portfolio > 1 || probes > 0)
+      usage();
+    return run_batch(batch_in, binary, alpha, p.nworkers, &p) < 0;
+  }
+  if(optind != argc-(input_name == NULL) || p.nworkers < 1 || k == NULL)
+    usage();
+  if((p.resume && p.checkpoint == NULL) || (p.checkpoint != NULL && p.nworkers > 1))
+    usage();
+  // Checkpoints and shards need the whole keystream; the key search has none of them, nor hints
+  int whole = p.checkpoint != NULL || p.nshards > 1 || shard_out != NULL;
+  int state_only = whole || use_hints || p.portfolio > 1 || probes > 0;
+  // The portfolio members are the threads, and the first solution stops them
+  if(p.portfolio > 1 && (p.nworkers > 1 || p.all || p.checkpoint != NULL || p.nshards > 1 || shard_out != NULL))
+    usage();
+  if(p.portfolio < 0 || p.restart_unit < 1)
+    usage();
+  if(incremental && (input_name == NULL || whole || solver == SOLVER_KEY || max_len < 1 || probes > 0))
+    usage();
+  if(incremental)
+    solver = SOLVER_STATE;
+  if(solver == SOLVER_KEY && (key_len < 1 || keysearch_keyspace(alpha, key_len) == 0 || state_only))
+    usage();
+  if(solver == SOLVER_AUTO && key_len < 1)
+    solver = SOLVER_STATE;
+  if(solver == SOLVER_AUTO)
+    solver = state_only ? SOLVER_STATE : plan_solver(alpha, key_len, p.all);
+
+  uint8_t *z; // keystream
+  int stream_len;
+  char *stream_str; // hex keystream, for the shard file
+  input in;
+  if(input_name == NULL)
+  {
+    // Parse hex keystream from the command line, convert it to binary and put to <z>
+    stream_str = argv[optind];
+    stream_len = strlen(stream_str)/2;
+    z = (uint8_t *)malloc(stream_len > 0 ? stream_len : 1);
+    const char *error = NULL;
+    if(stream_str[0] == 0)
+      error = "empty keystream";
+    else if(strlen(stream_str)%2 != 0 || fromHex(z, (uint8_t *)stream_str, stream_len, 0) < 0)
+      error = "malformed keystream";
+    for(l=0;l<stream_len && error == NULL;l++)
+      if(z[l] >= 1<<alpha)
+        error = "keystream value out of range for the word size";
+    if(error != NULL)
+    {
+      fprintf(stderr, "Keystream: %s\n", error);
+      return 1;
+    }
+  }
+  else
   {
-    s.t++;
-    if (ret == 0)
+    if(open_input(&in, input_name, binary, alpha) < 0)
     {
-      DEBUG_PRINT(("bt(): going deeper to level %d.\n",s.t));
-      bt(s, z, z_len);
+      fprintf(stderr, "Cannot open %s\n", input_name);
+      return 1;
+    }
+    if(incremental)
+    {
+      start_input_reader(&in, max_len);
+      p.feed = &in.feed;
+      stream_len = max_len; // the search sees the bytes as they arrive
+      pthread_mutex_lock(&in.feed.lock); // nothing can be searched before the first byte
+      while(in.feed.avail == 0 && !in.feed.done)
+        pthread_cond_wait(&in.feed.more, &in.feed.lock);
+      int empty = in.feed.avail == 0;
+      pthread_mutex_unlock(&in.feed.lock);
+      if(empty)
+      {
+        if(in.error == NULL)
+          fprintf(stderr, "%s: empty keystream\n", input_name);
+        return 1;
+      }
     }
     else
     {
-      DEBUG_PRINT(("bt(): skipping candidate (ret=%d).\n",ret));
+      if(read_input(&in) < 0)
+      {
+        fprintf(stderr, "%s: %s\n", input_name, in.error);
+        return 1;
+      }
+      if(in.z_len == 0)
+      {
+        fprintf(stderr, "%s: empty keystream\n", input_name);
+        return 1;
+      }
+      stream_len = in.z_len;
+    }
+    z = in.z;
+    stream_str = NULL;
+    if(shard_out != NULL)
+    {
+      stream_str = (char *)malloc(2*stream_len+1);
+      toHex((uint8_t *)stream_str, z, stream_len, 0);
     }
-    DEBUG_PRINT(("\n\n\n => Choosing next (%d) candidate (t=%d). The origin (c) is:\n",num, c.t));
-#ifdef DEBUG
-    debug_print_candidate(&c);
-#endif
-    num++;
-    s = next(c,s,z,&ret); // next will be derived from c, previously guessed values are stored in s
-#ifdef DEBUG
-    debug_print_candidate(&s);
-    //sanity_check(&s);
-#endif
   }
-  DEBUG_PRINT(("bt(): Parsed all children, none worked out. Going one level up.\n"));
-  return 0;
-}
-
-int main(int argc, char *argv[])
-{
-  if(argc < 2 || argc > 2)
+  if(use_hints)
   {
-    printf("Recover RC4 internal state from a keystream\n");
-    printf("Use ./rc4test to generate a keystream\n");
-    printf("Word size is defined in Makefile (ALPHA)\n\n");
-    printf("Usage: state-recovery KEYSTREAMHEX\n");
-#ifdef DEBUG
-    printf("\nDEBUG_PRINT is ENABLED\n");
-#endif
-    exit(0);
+    if(check_hints(&hints, alpha, stream_len) < 0)
+    {
+      fprintf(stderr, "Hints out of range for the word size or the keystream\n");
+      return 1;
+    }
+    p.hints = &hints;
+  }
+  if(solver == SOLVER_KEY)
+    return run_key_search(alpha, z, stream_len, key_len, p.nworkers, p.all);
+  p.z = z;
+  p.z_len = stream_len;
+  if(probes > 0)
+    return run_estimate(k, &p, probes);
+  recovery_stats_init(&stats, stream_len);
+  p.stats = (show_stats || shard_out != NULL) ? &stats : NULL;
+  if(shard_out != NULL)
+  {
+    p.on_solution = collect_json;
+    p.arg = &found;
+  }
+  signal(SIGUSR1, on_sigusr1);
+  if(p.checkpoint != NULL)
+  {
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
   }
 
-  // Parse hex keystream from the command line, convert it to binary and put to <z>
-  uint8_t *stream_str = (uint8_t *)argv[1];
-  int stream_len = strlen((char *)stream_str)/2;
-  uint8_t *z = (uint8_t*)alloca(stream_len); // keystream
-  fromHex(z, stream_str, stream_len, 0);
-
-  printf("Starting state recovery of RC4-%d...\n",SIZE);
+  if(p.all)
+  {
+    // stdout carries the solutions only
+    long n = k->solve(&p, &res);
+    if(report_status(&p, &res, stderr) < 0)
+      return 1;
+    fprintf(stderr, "Found %ld distinct states consistent with the keystream\n", n);
+    if(show_stats)
+      print_stats(&stats, stderr);
+    if(shard_out != NULL && write_shard(shard_out, alpha, stream_str, &p, res.status == RECOVERY_DONE, &stats, &found) < 0)
+      fprintf(stderr, "Cannot write %s\n", shard_out);
+    return 0;
+  }
 
-  candidate c = root();
-  DEBUG_PRINT(("Root candidate:\n"));
-#ifdef DEBUG
-  debug_print_candidate(&c);
-#endif
-  bt(c, z, stream_len);
-  
+  if(p.nshards > 1)
+    printf("Starting state recovery of RC4-%d, shard %d/%d...\n",1<<alpha,p.shard,p.nshards);
+  else if(p.portfolio > 1)
+    printf("Starting state recovery of RC4-%d (portfolio of %d)...\n",1<<alpha,p.portfolio);
+  else if(p.nworkers > 1)
+    printf("Starting state recovery of RC4-%d (%d threads)...\n",1<<alpha,p.nworkers);
+  else
+    printf("Starting state recovery of RC4-%d...\n",1<<alpha);
+
+  long solved = k->solve(&p, &res);
+  if(report_status(&p, &res, stdout) < 0)
+    return 1;
+  if(solved)
+  {
+    if(p.portfolio > 1)
+      printf("Found by portfolio member %d (%ld restarts)\n", res.member, res.restarts);
+    printf(" ** Success (t=%d) Press any key ** \n", res.t);
+    print_result(&res);
+    printf("Print any key to continue search or CTRL-C to interrupt\n");
+    state_list_add(&found, &res);
+  }
+  if(show_stats)
+    print_stats(&stats, stderr);
+  if(shard_out != NULL && write_shard(shard_out, alpha, stream_str, &p, res.status == RECOVERY_DONE, &stats, &found) < 0)
+    fprintf(stderr, "Cannot write %s\n", shard_out);
   return 0;
 }
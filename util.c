@@ -1,19 +1,27 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <alloca.h>
 #include <string.h>
 #include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "util.h"
 
 const uint8_t hexDigits[] = "0123456789abcdef";
 
-/* Convert array of bytes to its hexadecimal representation
-   <dst> -- a char array of size 2*<size>+1 (to store \0 byte)
-   <src> -- array of bytes to convert to hex
-   <size> -- lenght of <src>
-   <rev> -- if true, the last byte becomes the first hex digit, etc.
+// Value+1 of every hex digit, 0 for other characters (so that -1 is 0xFF)
+static const uint8_t hexValues[256] =
+{
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+  ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/* Convert array of bytes to its hexadecimal representation, one byte at a time
+   (the reference for toHex(), same arguments)
 */
-void toHex(uint8_t *dst, const uint8_t *src, size_t size, int rev)
+void toHexScalar(uint8_t *dst, const uint8_t *src, size_t size, int rev)
 {
   int incr = 1;
   const uint8_t *p = src;
@@ -36,6 +44,99 @@ void toHex(uint8_t *dst, const uint8_t *src, size_t size, int rev)
   dst[0] = 0;
 }
 
+#ifdef __SSE2__
+/* Hex digits of 16 bytes: 32 characters to <dst> */
+static inline void toHex16(uint8_t *dst, __m128i x)
+{
+  const __m128i mask = _mm_set1_epi8(0xF);
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+  __m128i lo = _mm_and_si128(x, mask);
+  __m128i a = _mm_unpacklo_epi8(hi, lo); // the high digit of a byte comes first
+  __m128i b = _mm_unpackhi_epi8(hi, lo);
+  // '0' + v, plus the gap between '9'+1 and 'a' for v > 9
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+  a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+  b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+  _mm_storeu_si128((__m128i *)dst, a);
+  _mm_storeu_si128((__m128i *)(dst+16), b);
+}
+
+/* Values of 32 hex digits at <src>: 16 bytes to <dst>
+ *
+ * @return 0, -1 if one of the characters is not a hex digit (<dst> is not written then)
+*/
+static inline int fromHex32(uint8_t *dst, const uint8_t *src)
+{
+  __m128i v[2];
+  int l;
+  for(l=0;l<2;l++)
+  {
+    __m128i c = _mm_loadu_si128((const __m128i *)(src+16*l));
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20)); // 'A'..'F' to 'a'..'f', digits stay
+    // Signed compares: characters above 0x7F are negative and fail both ranges
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9'+1)));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f'+1)));
+    if(_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xFFFF)
+      return -1;
+    v[l] = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                        _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a'-10))));
+    // Pairs of digits are 16 bit words h | l<<8, the byte is h<<4 | l
+    v[l] = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(v[l], 4), _mm_srli_epi16(v[l], 8)), _mm_set1_epi16(0xFF));
+  }
+  _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(v[0], v[1]));
+  return 0;
+}
+#endif
+
+/* Convert array of bytes to its hexadecimal representation
+   <dst> -- a char array of size 2*<size>+1 (to store \0 byte)
+   <src> -- array of bytes to convert to hex
+   <size> -- lenght of <src>
+   <rev> -- if true, the last byte becomes the first hex digit, etc.
+   16 bytes at a time with SSE2 (not in reverse)
+*/
+void toHex(uint8_t *dst, const uint8_t *src, size_t size, int rev)
+{
+#ifdef __SSE2__
+  if(!rev)
+  {
+    size_t l;
+    for(l=0;l+16<=size;l+=16)
+      toHex16(dst+2*l, _mm_loadu_si128((const __m128i *)(src+l)));
+    src += l;
+    dst += 2*l;
+    size -= l;
+  }
+#endif
+  toHexScalar(dst, src, size, rev);
+}
+
+/* Write the hex representation of a byte array to <out>, HEX_CHUNK bytes at a time
+ *
+ * @param out Stream to write to
+ * @param src Bytes to write
+ * @param size Number of bytes
+ * @param rev Write from last to first
+ * @return 0, -1 on write errors
+*/
+int writeHex(FILE *out, const uint8_t *src, size_t size, int rev)
+{
+  uint8_t buf[2*HEX_CHUNK+1];
+  size_t done = 0;
+  while(done < size)
+  {
+    size_t n = size - done < HEX_CHUNK ? size - done : HEX_CHUNK;
+    // in reverse the chunks are taken from the end
+    toHex(buf, rev ? src + size - done - n : src + done, n, rev);
+    if(fwrite(buf, 2, n, out) != n)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
 /* Print hex representation of a byte array
   <p> -- pointer to the array
   <size> -- size of the array
@@ -43,31 +144,23 @@ void toHex(uint8_t *dst, const uint8_t *src, size_t size, int rev)
 */
 void showHex(const uint8_t *p, size_t size, int rev)
 {
-  uint8_t* buf = (uint8_t*)alloca(2*size + 1);
-  toHex(buf, p, size, rev);
-  printf("%s", buf);
+  writeHex(stdout, p, size, rev);
 }
 
 /* Convert a hex character to number that it represents
    <h> -- character to convert
+   Returns 0xFF if <h> is not a hex digit
 */
 uint8_t fromHexDigit(uint8_t h)
 {
-  if(PREDICT_LIKELY('0'<=h && h<='9')) return      (h - '0');
-  if(PREDICT_LIKELY('a'<=h && h<='f')) return 10 + (h - 'a');
-  if(PREDICT_LIKELY('A'<=h && h<='F')) return 10 + (h - 'A');
-  return 0xFF;
+  return hexValues[h] - 1;
 }
 
 /**
- * Convert a hex string to binary
- *
- * @param dst Binary array to fill
- * @param src Hex string
- * @param dstSize Size of dst
- * @param rev If set, convert from last to first
+ * Convert a hex string to binary, one byte at a time (the reference for
+ * fromHex(), same arguments)
 */
-int fromHex(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev)
+int fromHexScalar(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev)
 {
   int incr = 2;
   uint8_t *end = dstSize + dst;
@@ -91,3 +184,96 @@ int fromHex(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev)
 
   return 0;
 }
+
+/**
+ * Convert a hex string to binary
+ *
+ * 16 bytes at a time with SSE2 (not in reverse).
+ *
+ * @param dst Binary array to fill
+ * @param src Hex string
+ * @param dstSize Size of dst
+ * @param rev If set, convert from last to first
+ * @return 0, -1 if <src> has a character which is not a hex digit
+*/
+int fromHex(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev)
+{
+#ifdef __SSE2__
+  if(!rev)
+  {
+    size_t l;
+    for(l=0;l+16<=dstSize;l+=16)
+      if(PREDICT_UNLIKELY(fromHex32(dst+l, src+2*l) < 0))
+        return -1;
+    dst += l;
+    src += 2*l;
+    dstSize -= l;
+  }
+#endif
+  return fromHexScalar(dst, src, dstSize, rev);
+}
+
+/* 32 hex digits to 16 bytes, see fromHex32()
+*/
+static inline int fromHex16(uint8_t *dst, const uint8_t *src)
+{
+#ifdef __SSE2__
+  return fromHex32(dst, src);
+#else
+  return fromHexScalar(dst, src, 16, 0);
+#endif
+}
+
+/**
+ * Convert the next piece of a hex stream to binary
+ *
+ * Whitespace between the digits is skipped, and a byte may be split
+ * between two pieces (hs->digit holds its first digit). Runs of 32
+ * digits without whitespace are converted 16 bytes at a time.
+ *
+ * @param hs State of the stream, zeroed with hexStreamInit() before the first piece
+ * @param dst Binary array to fill, room for (<size>+1)/2 bytes
+ * @param src Next piece of the stream
+ * @param size Length of <src>
+ * @return Number of bytes written to <dst>; at a character which is
+ *         neither a hex digit nor whitespace the conversion stops there
+ *         and sets hs->malformed
+*/
+long fromHexChunk(struct hex_stream *hs, uint8_t *dst, const uint8_t *src, size_t size)
+{
+  uint8_t *start = dst;
+  size_t l = 0, scalar = 0; // characters before <scalar> go one at a time
+  while(l < size)
+  {
+    if(hs->digit < 0 && l >= scalar && l + 32 <= size)
+    {
+      if(fromHex16(dst, src+l) == 0)
+      {
+        dst += 16;
+        l += 32;
+        continue;
+      }
+      scalar = l + 32; // whitespace or garbage in there, up to the whitespace one at a time
+    }
+    uint8_t c = src[l++];
+    uint8_t v = fromHexDigit(c);
+    if(PREDICT_UNLIKELY(v == 0xFF))
+    {
+      if(c == ' ' || c == '\t' || c == '\n' || c == '\r')
+      {
+        scalar = 0;
+        continue;
+      }
+      hs->malformed = 1;
+      break;
+    }
+    if(hs->digit < 0)
+      hs->digit = v;
+    else
+    {
+      *(dst++) = (hs->digit << 4) | v;
+      hs->digit = -1;
+    }
+  }
+  return dst - start;
+}
@@ -1,6 +1,10 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 /* GCC has several useful attributes. */
 #if defined(__GNUC__) && __GNUC__ >= 3
 /** Macro: Evaluates to <b>exp</b> and hints the compiler that the value
@@ -26,9 +30,29 @@
 
 
 
+// Bytes converted at a time by writeHex() (its buffer is on the stack)
+#define HEX_CHUNK (4096)
+
+/* State of a hex stream read in pieces, see fromHexChunk() */
+struct hex_stream
+{
+  int digit; // first digit of a byte split between two pieces, -1 if none
+  int malformed; // set at a character which is neither a hex digit nor whitespace
+};
+
+static inline void hexStreamInit(struct hex_stream *hs)
+{
+  hs->digit = -1;
+  hs->malformed = 0;
+}
+
 void toHex(uint8_t *dst, const uint8_t *src, size_t size, int rev);  
+void toHexScalar(uint8_t *dst, const uint8_t *src, size_t size, int rev);
+int writeHex(FILE *out, const uint8_t *src, size_t size, int rev);
 void showHex(const uint8_t *src, size_t size, int rev);  
 uint8_t fromHexDigit(uint8_t h);  
 int fromHex(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev); 
+int fromHexScalar(uint8_t *dst, const uint8_t *src, size_t dstSize, int rev);
+long fromHexChunk(struct hex_stream *hs, uint8_t *dst, const uint8_t *src, size_t size);
 
 #endif // __UTIL_H__